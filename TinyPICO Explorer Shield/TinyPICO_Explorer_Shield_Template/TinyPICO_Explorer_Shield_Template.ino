@@ -10,11 +10,17 @@
 #include <Adafruit_ST7789.h> // Hardware-specific library for ST7789
 #include <Adafruit_LIS3DH.h>
 #include <Adafruit_Sensor.h>
+#include <TinyPICOScheduler.h>
+#include <TinyPICOAccel.h>
+#include <TinyPICOOrientation.h>
+#include <TinyPICOBoot.h>
 
 #include "buttons.h"
 #include "secret.h"
 #include "bitmaps.h"
-#include "helpers.h"
+#include "text.h"
+#include "power.h"
+#include "logger.h"
 
 #if defined(ARDUINO_TINYS3)
 
@@ -48,33 +54,78 @@
 #define TFT_BACKLIGHT 27
 #define TFT_CS 14
 #define TCT_DC 4
+#define HAS_BATTERY_SENSE
 
 #endif
 
 #define TFT_RESET -1
 
+#ifdef HAS_BATTERY_SENSE
+#include <TinyPICO.h>
+TinyPICO tp = TinyPICO();
+#endif
+
+// The MPR121 IRQ line isn't routed to an IO on the shield. If you wire it to a spare IO, set it here
+// and the button manager will be interrupt driven instead of polling the MPR121 every loop.
+#define TOUCH_IRQ -1
+
+// If an IO Expander shield is stacked, its INT pin can wake us from sleep. Set the IO it is wired to here.
+#define EXPANDER_INT -1
+
 // Declaration for the ST7789
 Adafruit_ST7789 tft = Adafruit_ST7789(TFT_CS, TCT_DC, TFT_RESET);
 
 // Declaration for the LIS3DH accelerometer
 Adafruit_LIS3DH lis = Adafruit_LIS3DH();
 
+// Streams LIS3DH samples from its FIFO, woken by the watermark interrupt on IMU_INT
+TinyPICOAccel accel;
+
 
 ExplorerButtonManager buttonManager;
 
+// Glyph cached text renderer for the built in font at size 2
+TextRenderer text2(tft, nullptr, 2);
+
+// Deep sleep countdown - positioned when the warning is first shown
+NumericField dsCountdown(text2, 0, 0, ALIGN_RIGHT, ST77XX_BLUE, ST77XX_BLACK);
+
+int idle_time_to_lightsleep = 1000 * 5; // 5 seconds in millis
 int idle_time_to_deepsleep = 1000 * 30; // 30 seconds in millis
 int idle_time_to_deepsleep_warning = 1000 * 10; // 10 seconds in millis
 unsigned long last_button_touched = 0;
 unsigned long one_second_step = 0;
 bool is_sec_step = false;
 bool is_showing_ds_warning = false;
-unsigned long nextReadTimeIMU = 0;
+// Sensor polling - light sensor every 500ms
+TinyPICOScheduler scheduler;
+int jobLightSensor = -1;
+
 double roll = 0.00, pitch = 0.00;   //Roll & Pitch are the angles which rotate by the axis X and y
+TinyPICOOrientation orientation;
 
-unsigned long nextReadTimeLightSensor = 0;
 float lightSensorVal;
 
 int currentState = 0;
+
+// Runs the peripheral inits in setup() in parallel
+TinyPICOBoot boot;
+
+// Logs the IMU stream and battery voltage to the SD card, if there is one
+DataLogger logger;
+int sdCardState = 0;
+int jobBattery = -1;
+
+// Light sleeps between sensor reads once idle, deep sleeps after idle_time_to_deepsleep
+PowerManager power;
+
+// Everything we want back after a deep sleep wake
+struct AppState
+{
+  int currentState;
+  float lightSensorVal;
+};
+
 bool isToneInit = false;
 
 void Tone(uint32_t freq)
@@ -137,6 +188,16 @@ void setup()
 {
   Serial.begin(115200);
 
+  // Find out if we are waking from our own deep sleep, and if so get our state back
+  power.begin();
+  AppState saved;
+  bool resumed = power.resumed() && power.restore(saved);
+  if (resumed)
+  {
+    currentState = saved.currentState;
+    lightSensorVal = saved.lightSensorVal;
+  }
+
   WiFi.disconnect(true);
   WiFi.mode(WIFI_OFF);
 
@@ -153,7 +214,88 @@ void setup()
   pinMode(LIGHT_SENSOR, INPUT);
   pinMode(SD_CARD_DETECT, INPUT_PULLUP);
 
-  delay(500);
+  Serial.println();
+
+  // Bring the peripherals up in parallel - see the Stage functions below for what depends on what
+  int stageDisplay = boot.AddStage("Display", StageDisplay, &resumed);
+  int stageI2C = boot.AddStage("I2C", StageI2C);
+  int stageTouch = boot.AddStage("Touch", StageTouch, NULL, TinyPICOBoot::After(stageI2C));
+  int stageIMU = boot.AddStage("IMU", StageIMU, NULL, TinyPICOBoot::After(stageI2C));
+  boot.AddStage("SD Card", StageSDCard, NULL, TinyPICOBoot::After(stageDisplay));
+
+  // Waking from deep sleep skips the splash screen and boot sound
+  if (!resumed)
+  {
+    boot.AddStage("Splash", StageSplash, NULL, TinyPICOBoot::After(stageDisplay));
+    boot.AddStage("Sound", StageSound);
+  }
+
+  // A stage that failed or timed out shows up in the report. Only touch and the IMU are essential.
+  if (!boot.Run())
+    Serial.println("Warning - not every boot stage succeeded");
+  boot.PrintReport(Serial);
+
+  if (!boot.Succeeded(stageTouch))
+  {
+    Serial.println("Error - MPR121 Not found or failed to start - Execution halted!");
+    while (1) {
+      delay(10);
+    }
+  }
+
+  if (!boot.Succeeded(stageIMU))
+  {
+    Serial.println("Error - LIS3DH Not Found or failed to start - Execution halted!");
+    while (1) {
+      delay(10);
+    }
+  }
+
+  // Show TinyPICO Logo & Explorer Shield info
+  tft.fillScreen(ST77XX_BLACK);
+  tft.drawBitmap( 25, 20, TP_Logo, 190, 44, ST77XX_BLUE);
+  tft.setTextSize(2);
+  tft.setCursor(30, 72);
+  tft.println( "EXPLORER SHIELD" );
+
+  // Start polling the sensors
+  jobLightSensor = scheduler.AddJob("Light", ReadLightSensor, NULL, 500);
+
+  // Log every IMU sample, and the battery once a second
+  if (sdCardState == 1)
+  {
+    logger.setScales(accel.GetMilliGPerDigit(), 0);
+    if (logger.begin(SD))
+    {
+      Serial.print("Logging to file ");
+      Serial.println(logger.getFileIndex());
+      accel.AddConsumer(LogAccel, NULL);
+#ifdef HAS_BATTERY_SENSE
+      jobBattery = scheduler.AddJob("Battery", LogBattery, NULL, 1000);
+#endif
+    }
+  }
+
+  // Wake on touch pad 3 (IO15) with a threshold of 70 for higher sensitivity, and on the
+  // MPR121 and expander interrupts if they are wired up
+  power.addWakeTouch(T3, 70);
+  power.addWakePin(TOUCH_IRQ, LOW, FALLING);
+  power.addWakePin(EXPANDER_INT, LOW);
+  // The LIS3DH FIFO fills in 320ms at 100Hz, so the watermark has to wake light sleep too, or samples
+  // are dropped. It doesn't need to wake us from deep sleep.
+  power.addWakePin(IMU_INT, HIGH, RISING, false);
+  // anything we expect to be idle for longer than the sleep warning is worth a deep sleep
+  power.setDeepSleepThreshold(idle_time_to_deepsleep_warning);
+  power.onSleep(PowerSleeping);
+}
+
+// Boot stages - each runs in its own task once the stages it depends on are done
+
+bool StageDisplay(void *context)
+{
+  bool resumed = *(bool *)context;
+  if (!resumed)
+    delay(500);
 
   pinMode(TFT_BACKLIGHT, OUTPUT);
   // Digital ON/OFF for TFT Backlight
@@ -165,58 +307,75 @@ void setup()
   // ledcAttachPin(TFT_BACKLIGHT, 0);
   // ledcWrite(0, 0);
 
-  Serial.println();
-
   // Init ST7789 240x240
   tft.init(240, 240);
+  tft.setRotation(0);
   tft.fillScreen(ST77XX_BLACK);
 
+  // Build the glyph cache for our text renderer
+  text2.begin();
+  return true;
+}
+
+// Touch and IMU both begin Wire, so start it once here rather than have them race to do it
+bool StageI2C(void *context)
+{
+  return Wire.begin();
+}
+
+bool StageTouch(void *context)
+{
   // Initialise the button manager
-  buttonManager.begin(button_Touched);
+  if (!buttonManager.begin(button_Touched, TOUCH_IRQ))
+    return false;
   // Example of how to wire up a button for click and long press callbacks
   buttonManager.assignCallbacks('1', button1_Click, button1_LongPress);
+  return true;
+}
 
+bool StageIMU(void *context)
+{
   // Initialise the LIS3DH at addreess 0x18
   if (!lis.begin(0x18))
-  {
-    Serial.println("Error - LIS3DH Not Found or failed to start - Execution halted!");
-    while (1) {
-      delay(10);
-    }
-  }
-  else
-  {
-    // Set the IMU rage - options are 2, 4, 8 or 16 G
-    lis.setRange(LIS3DH_RANGE_4_G);
-
-    Serial.print("LIS3DH Range = ");
-    Serial.print(2 << lis.getRange());
-    Serial.println("G");
-  }
-
-  delay(100);
-
-  // Show initial UM Logo as a splash screen.
-  tft.fillScreen(ST77XX_BLACK);
-  tft.setRotation(0);
-  tft.drawBitmap( 30, ( tft.height() / 2 ) - 45 , UM_Logo, 180, 90, ST77XX_WHITE);
+    return false;
 
-  // Play a boot sound
-  BootSound();
+  // Set the IMU rage - options are 2, 4, 8 or 16 G
+  lis.setRange(LIS3DH_RANGE_4_G);
 
-  delay(1000);
+  Serial.print("LIS3DH Range = ");
+  Serial.print(2 << lis.getRange());
+  Serial.println("G");
 
-  // Show TinyPICO Logo & Explorer Shield info
-  tft.fillScreen(ST77XX_BLACK);
-  tft.drawBitmap( 25, 20, TP_Logo, 190, 44, ST77XX_BLUE);
-  tft.setTextSize(2);
-  tft.setCursor(30, 72);
-  tft.println( "EXPLORER SHIELD" );
+  // Hand over to the FIFO - 100Hz samples delivered in blocks of 16
+  if (!accel.begin(0x18, IMU_INT, ACCEL_ODR_100HZ, 16))
+    Serial.println("Error - LIS3DH FIFO setup failed!");
+  accel.AddConsumer(GrabAccel, NULL);
+  return true;
+}
 
+// The card shares SPI with the display, so this waits for the display init to finish
+bool StageSDCard(void *context)
+{
   // Gety the state of the SD Card
+  sdCardState = GetSDCard();
   Serial.print("uSD Card: ");
-  Serial.println(GetSDCard());
+  Serial.println(sdCardState);
+  return sdCardState != 2;
+}
 
+bool StageSplash(void *context)
+{
+  // Show initial UM Logo as a splash screen, and leave it up while everything else starts
+  tft.drawBitmap( 30, ( tft.height() / 2 ) - 45 , UM_Logo, 180, 90, ST77XX_WHITE);
+  delay(1000);
+  return true;
+}
+
+bool StageSound(void *context)
+{
+  // Play a boot sound
+  BootSound();
+  return true;
 }
 
 void loop() {
@@ -224,6 +383,12 @@ void loop() {
   // Tick buttons via the Button Manager
   last_button_touched = buttonManager.tick();
 
+  // Run whichever sensor read is due next
+  scheduler.Tick();
+
+  // Collect accelerometer samples if the FIFO watermark has been hit
+  accel.Service();
+
 
   if ( millis() - one_second_step > 1000 )
   {
@@ -234,16 +399,32 @@ void loop() {
     is_sec_step = false;
 
 
-  // Lastly, run the deep sleep timer if you want the device to sleep after a certain period
-  // RunDeepSleepTimer();
+  // Lastly, run the sleep timer if you want the device to sleep after a certain period
+  // RunSleepTimer();
 }
 
-void RunDeepSleepTimer()
+void RunSleepTimer()
 {
+  unsigned long idle = millis() - last_button_touched;
+
   // Have we been idle long enough to go into deep sleep?
-  if (millis() - last_button_touched > idle_time_to_deepsleep)
-    SetupDeepSleep();
-  else if (millis() - last_button_touched > idle_time_to_deepsleep - idle_time_to_deepsleep_warning )
+  if (idle > idle_time_to_deepsleep)
+  {
+    power.sleep(UINT32_MAX);
+    return;
+  }
+
+  // Light sleep until the next sensor read is due, waking at least once a second for the countdown.
+  // Touches are still picked up within one sleep, or straight away if TOUCH_IRQ is wired, and the
+  // IMU watermark wakes us to empty the FIFO before it overflows.
+  if (idle > idle_time_to_lightsleep)
+  {
+    uint32_t sleepMs = min(scheduler.GetTimeToNextJob() / 1000, (uint32_t)(1000 - (millis() - one_second_step) % 1000));
+    if (sleepMs > 0)
+      power.sleep(sleepMs);
+  }
+
+  if (millis() - last_button_touched > idle_time_to_deepsleep - idle_time_to_deepsleep_warning )
   {
     // We only show the deep sleep warning when there is 10 seconds left or less and a whole second has flipped
     if (is_sec_step)
@@ -257,37 +438,47 @@ void RunDeepSleepTimer()
     tft.fillRect(0, 220, 240, 20, ST77XX_BLACK);
   }
 }
+
 void ShowDeepSleepWarning(int time_left)
 {
   // we want to count down from 10 to 1, not 9 to 0
   time_left = round(time_left / 1000) + 1;
 
-  tft.fillRect(0, 220, 240, 20, ST77XX_BLACK);
-  tft.setTextSize(2);
-  tft.setTextColor(ST77XX_BLUE);
-  println_Center(tft, "DEEP SLEEP in " + String(time_left) + "s", tft.width() / 2, 230);
-  is_showing_ds_warning = true;
-}
+  if (!is_showing_ds_warning)
+  {
+    // Draw the static part of the message once, leaving room for a 2 digit countdown
+    const char *prefix = "DEEP SLEEP in ";
+    uint16_t fieldWidth = text2.measure("00");
+    uint16_t totalWidth = text2.measure(prefix) + fieldWidth + text2.measure("s");
+    int16_t x = tft.width() / 2 - totalWidth / 2;
+    int16_t y = 230 - text2.height() / 2;
 
-void DeepSleepCallback()
-{
-  //placeholder callback function
-}
+    tft.fillRect(0, 220, 240, 20, ST77XX_BLACK);
+    x = text2.draw(prefix, x, y, ST77XX_BLUE) + fieldWidth;
+    text2.draw("s", x, y, ST77XX_BLUE);
 
+    // the countdown is right aligned against the "s"
+    dsCountdown.setPosition(x, y);
+    is_showing_ds_warning = true;
+  }
 
-void SetupDeepSleep()
-{
-  /*
-     Make sure we display a message to the user before this happens, letting them know we are
-     going to go into deep sleep, so they have an opportunity to touch a button and prevent it from happening
+  // Only the digits that changed get redrawn
+  dsCountdown.set(time_left);
+}
 
-  */
+// Called by the power manager just before sleeping
+void PowerSleeping(PowerSleepKind kind)
+{
+  // Light sleeps are short and the IOs keep their levels, so the screen stays on and unchanged
+  if (kind == POWER_LIGHT_SLEEP)
+    return;
 
-  // Interrupt on IO15 (Touch Pad 3) with a thresholf of 70 for higher sensitivity
-  touchAttachInterrupt(T3, DeepSleepCallback, 70);
+  // Keep what we need to pick up where we left off
+  AppState state = { currentState, lightSensorVal };
+  power.save(state);
 
-  //Configure Touchpad as wakeup source
-  esp_sleep_enable_touchpad_wakeup();
+  // Get the last of the log onto the card
+  logger.end();
 
   // Clear the TFT
   tft.fillScreen(ST77XX_BLACK);
@@ -309,20 +500,17 @@ void SetupDeepSleep()
 
   gpio_deep_sleep_hold_en();
   delay(5);
-
-  //Go to sleep now
-  Serial.println("Going to sleep now");
-  esp_deep_sleep_start();
 }
 
 
+// Latest light sensor value, updated by the scheduler
 float GrabLightSensor()
 {
-  // If it's not time to read the input, return the cached value
-  if ( nextReadTimeLightSensor > millis() )
-    return lightSensorVal;
-  // Set the next read time to 500ms from now
-  nextReadTimeLightSensor = millis() + 500;
+  return lightSensorVal;
+}
+
+void ReadLightSensor(void *context)
+{
   lightSensorVal = 0;
   // Read the value from the sensor
 
@@ -332,29 +520,18 @@ float GrabLightSensor()
 #else
   lightSensorVal = analogRead( LIGHT_SENSOR );
 #endif
-
-  return lightSensorVal;
 }
 
 
-void GrabAccel()
+// Called by the accelerometer service with each block of FIFO samples
+void GrabAccel(void *context, const AccelSample *samples, uint8_t count, uint32_t newestTimeUs, uint32_t periodUs)
 {
-  // If it's not time to read the input, return early
-  if ( nextReadTimeIMU > millis() )
-    return;
-
-  // Set the next read time to 200ms from now
-  nextReadTimeIMU = millis() + 200;
-
-  sensors_event_t event;
-  lis.getEvent(&event);
+  // Every sample goes through the fixed point orientation filter, which smooths out the noise
+  orientation.Update(samples, count);
 
-  double x_Buff = float(event.acceleration.x);
-  double y_Buff = float(event.acceleration.y);
-  double z_Buff = float(event.acceleration.z);
-
-  roll = atan2(y_Buff , z_Buff) * 57.3;
-  pitch = atan2((- x_Buff) , sqrt(y_Buff * y_Buff + z_Buff * z_Buff)) * 57.3;
+  // centidegrees to degrees
+  roll = orientation.GetRoll() / 100.0;
+  pitch = orientation.GetPitch() / 100.0;
 
   Serial.print("IMU Roll: ");
   Serial.print(roll);
@@ -363,6 +540,19 @@ void GrabAccel()
 
 }
 
+void LogAccel(void *context, const AccelSample *samples, uint8_t count, uint32_t newestTimeUs, uint32_t periodUs)
+{
+  for (int i = 0; i < count; i++)
+    logger.logAccel(newestTimeUs - (count - 1 - i) * periodUs, samples[i].x, samples[i].y, samples[i].z);
+}
+
+#ifdef HAS_BATTERY_SENSE
+void LogBattery(void *context)
+{
+  logger.logBattery(micros(), tp.GetBatteryVoltage() * 1000);
+}
+#endif
+
 // Wifi Stuff
 int8_t GetWifiQuality()
 {
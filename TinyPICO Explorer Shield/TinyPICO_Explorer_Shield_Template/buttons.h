@@ -8,27 +8,39 @@ extern "C" {
   typedef void (*callbackFunction)(void);
 }
 
+// Number of pending touch events we can hold between ticks - must be a power of 2
+#define TOUCH_QUEUE_SIZE 16
+// Status reads per IRQ wake - bounds the reader if the MPR121 holds IRQ low for something other than a touch change
+#define TOUCH_MAX_READS 4
+
+// One change of the touch status, read as soon as the IRQ fired
+struct TouchEvent
+{
+  uint32_t timeUs;    // when the IRQ fired
+  uint16_t touched;   // electrode status after the change
+  uint16_t changed;   // electrodes that changed - can be set with the level unchanged if a press and release were merged
+};
+
 class ExplorerButton
 {
   public:
     ExplorerButton();
 
-    void setupButton(char button, Adafruit_MPR121 cap, callbackFunction touchBeep);
+    void setupButton(char button, callbackFunction touchBeep);
     void attachPress(callbackFunction newFunction);
     void attachPressLong(callbackFunction newFunction);
 
-    bool tick(void);
-    bool tick(bool level);
+    bool tick(uint16_t touched, uint16_t changed, uint32_t timeUs);
+    bool tick(bool level, bool changed, uint32_t timeUs);
     void reset(void);
 
     int getId(char button);
 
   private:
-    Adafruit_MPR121 _cap;
     char _ids[12] = {'3', '2', '1', 'D', 'L', 'R', '4', 'U', 'B', 'A', 'Y', 'X'};
     int _id = -1; // button face id from MPR
-    unsigned int _clickTicks = 100; // number of ticks before a click is detected
-    unsigned int _pressTicks = 300; // number of ticks before a long press is detected
+    uint32_t _clickTicks = 100000; // microseconds held before a click is detected
+    uint32_t _pressTicks = 300000; // microseconds held before a long press is detected
 
     // These variables will hold functions acting as event source.
     callbackFunction _touchBeep = NULL;
@@ -36,7 +48,7 @@ class ExplorerButton
     callbackFunction _pressLongFunc = NULL;
 
     int _state = 0;
-    unsigned long _startTime;
+    uint32_t _startTime; // micros() timestamp of the touch
 };
 
 
@@ -44,9 +56,8 @@ ExplorerButton::ExplorerButton()
 {
 }
 
-void ExplorerButton::setupButton(char button, Adafruit_MPR121 cap, callbackFunction touchBeep = nullptr)
+void ExplorerButton::setupButton(char button, callbackFunction touchBeep = nullptr)
 {
-  _cap = cap;
   _id = getId(button);
   _touchBeep = touchBeep;
 }
@@ -78,20 +89,27 @@ void ExplorerButton::reset(void) {
   _startTime = 0;
 }
 
-bool ExplorerButton::tick(void)
+// touched and changed are the electrode bitmasks of one touch event from the ExplorerButtonManager
+// timeUs is when that touch state took effect, not when we got around to processing it
+bool ExplorerButton::tick(uint16_t touched, uint16_t changed, uint32_t timeUs)
 {
   // We only want to tick this button if it has an ID.
   if (_id > -1 )
-    return tick(_cap.touched() & _BV(_id));
+    return tick((bool)(touched & _BV(_id)), (bool)(changed & _BV(_id)), timeUs);
 
    return false;
 }
 
-bool ExplorerButton::tick(bool activeLevel)
+bool ExplorerButton::tick(bool activeLevel, bool changed, uint32_t now)
 {
-  unsigned long now = millis(); // current time in milis.
   bool was_touched = false;
 
+  // Changed but back at the level we already had, so events were merged - a press and release in the
+  // idle state, a release and press while held. Play out the missing half first. We don't know when a
+  // merged press started, so date it just far enough back to count as a click.
+  if (changed && activeLevel == (_state == 1))
+    was_touched = tick(!activeLevel, true, _state == 0 ? now - _clickTicks - 1 : now);
+
   if (_state == 0) // Start state
   {
     if (activeLevel)
@@ -112,12 +130,12 @@ bool ExplorerButton::tick(bool activeLevel)
       was_touched = true;
 
       // Did we hold long enough for a long press and do we have a long press callback?
-      if ( ((unsigned long)(now - _startTime) > _pressTicks) && _pressLongFunc )
+      if ( ((uint32_t)(now - _startTime) > _pressTicks) && _pressLongFunc )
       {
         _pressLongFunc();
       }
       // Ok, not a long press, so do we have a click callback?
-      else if ( ((unsigned long)(now - _startTime) > _clickTicks) && _pressFunc )
+      else if ( ((uint32_t)(now - _startTime) > _clickTicks) && _pressFunc )
       {
         _pressFunc();
       }
@@ -135,21 +153,48 @@ class ExplorerButtonManager
   public:
     ExplorerButtonManager();
     unsigned long tick(void);
-    void begin(callbackFunction touchBeep);
+    // false if the MPR121 didn't answer - don't tick() the manager then
+    bool begin(callbackFunction touchBeep, int irqPin);
     void assignCallbacks(char face, callbackFunction click, callbackFunction press);
     int getId(char button);
+    // touch events merged because the queue was full
+    uint32_t getOverruns(void) { return _irqOverruns; }
   private:
+    static void IRAM_ATTR touchISR(void *arg);
+    static void touchTask(void *arg);
+    void readTouches(uint32_t timeUs);
+    unsigned long processTouches(const TouchEvent &event);
+
     Adafruit_MPR121 cap;
     char _ids[12] = {'3', '2', '1', 'D', 'L', 'R', '4', 'U', 'B', 'A', 'Y', 'X'};
     ExplorerButton buttons[12];
     unsigned long last_touch = 0;
+    uint16_t _lastTouched = 0;
+
+    // The ISR wakes the reader task, which reads the status over I2C straight away, so a stalled loop()
+    // can't hide a short tap. Single producer (reader task) / single consumer (tick) ring of touch events -
+    // the reader only ever writes _irqHead and tick() only ever writes _irqTail, so no locking is needed -
+    // the slot is written before a release store of the head, and read after an acquire load of it.
+    int _irqPin = -1;
+    TaskHandle_t _task = NULL;
+    volatile uint32_t _irqTime = 0;
+    TouchEvent _events[TOUCH_QUEUE_SIZE];
+    volatile uint8_t _irqHead = 0;
+    volatile uint8_t _irqTail = 0;
+    volatile uint32_t _irqOverruns = 0;
+
+    // reader task only - changes that didn't fit in the queue, merged until there's room. tick() only
+    // peeks at the flag, to know the reader needs another nudge.
+    TouchEvent _pending;
+    volatile bool _hasPending = false;
 };
 
 ExplorerButtonManager::ExplorerButtonManager()
 {
 }
 
-void ExplorerButtonManager::begin(callbackFunction touchBeep = nullptr)
+// irqPin is the GPIO the MPR121 IRQ line is wired to, or -1 to poll the MPR121 every tick
+bool ExplorerButtonManager::begin(callbackFunction touchBeep = nullptr, int irqPin = -1)
 {
   Serial.println("Button Manager Setup!");
   // Declaration for the MPR121 Cap Touch IC
@@ -157,32 +202,151 @@ void ExplorerButtonManager::begin(callbackFunction touchBeep = nullptr)
   // Initialise MPR121 at address 0x5A
   if (!cap.begin(0x5A))
   {
-    Serial.println("Error - MPR121 Not found  - Execution halted!");
-    while (1) {
-      delay(10);
-    }
+    Serial.println("Error - MPR121 Not found!");
+    return false;
   }
 
   for ( int id = 0; id < 12; id++ )
   {
     buttons[id] = ExplorerButton();
-    buttons[id].setupButton(_ids[id], cap, touchBeep );
+    buttons[id].setupButton(_ids[id], touchBeep );
+  }
+
+  // The MPR121 pulls IRQ low whenever the touch status changes and holds it there until the status is read
+  _irqPin = irqPin;
+  if ( _irqPin > -1 )
+  {
+    pinMode( _irqPin, INPUT_PULLUP );
+    if ( xTaskCreate( touchTask, "Touch", 3072, this, 2, &_task ) != pdPASS )
+    {
+      Serial.println("Error - touch reader task failed, polling instead");
+      _irqPin = -1;
+    }
+    else
+    {
+      attachInterruptArg( digitalPinToInterrupt(_irqPin), touchISR, this, FALLING );
+
+      // IRQ may already be low from before we attached, and then there's no edge to come - read once to release it
+      xTaskNotifyGive( _task );
+    }
   }
 
   last_touch = millis();
+  return true;
 };
 
-unsigned long ExplorerButtonManager::tick()
+void IRAM_ATTR ExplorerButtonManager::touchISR(void *arg)
+{
+  // We can't talk I2C from an ISR, so timestamp the change and wake the reader task
+  ExplorerButtonManager *self = (ExplorerButtonManager *)arg;
+  self->_irqTime = micros();
+
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR( self->_task, &woken );
+  if ( woken )
+    portYIELD_FROM_ISR();
+}
+
+void ExplorerButtonManager::touchTask(void *arg)
+{
+  ExplorerButtonManager *self = (ExplorerButtonManager *)arg;
+  for ( ;; )
+  {
+    ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+
+    // Keep reading while IRQ stays low - a change that lands during a read doesn't make a new edge
+    uint32_t timeUs = self->_irqTime;
+    for ( int reads = 0; reads < TOUCH_MAX_READS; reads++ )
+    {
+      self->readTouches( timeUs );
+      if ( digitalRead( self->_irqPin ) != LOW )
+        break;
+      timeUs = micros();
+    }
+  }
+}
+
+// reader task side - one I2C read of the status of all 12 electrodes, queued with what changed
+void ExplorerButtonManager::readTouches(uint32_t timeUs)
 {
+  uint16_t touched = cap.touched();
+  uint16_t changed = touched ^ _lastTouched;
+  _lastTouched = touched;
+  if ( !changed && !_hasPending )
+    return;
+
+  if ( _hasPending )
+  {
+    // merge into what's already waiting, keeping the earlier time
+    _pending.touched = touched;
+    _pending.changed |= changed;
+  }
+  else
+  {
+    _pending = { timeUs, touched, changed };
+    __atomic_store_n(&_hasPending, true, __ATOMIC_RELAXED);
+  }
+
+  uint8_t head = _irqHead;
+  uint8_t next = (head + 1) & (TOUCH_QUEUE_SIZE - 1);
+  if ( next == __atomic_load_n(&_irqTail, __ATOMIC_ACQUIRE) )
+  {
+    // Full - hold on to it and merge the next change in, so the change mask still records every electrode
+    _irqOverruns++;
+    return;
+  }
+
+  // the event has to be in its slot before tick() can see the new head, on either core
+  _events[head] = _pending;
+  __atomic_store_n(&_irqHead, next, __ATOMIC_RELEASE);
+  __atomic_store_n(&_hasPending, false, __ATOMIC_RELAXED);
+}
+
+unsigned long ExplorerButtonManager::processTouches(const TouchEvent &event)
+{
+  // Nothing changed, nothing to do
+  if ( !event.changed )
+    return last_touch;
+
   for ( int id = 0; id < 12; id++ )
   {
-    if (buttons[id].tick())
+    if (buttons[id].tick(event.touched, event.changed, event.timeUs))
     {
       // a button was touched, so update last button touch time
       last_touch = millis();
     }
   }
 
+  return last_touch;
+}
+
+unsigned long ExplorerButtonManager::tick()
+{
+  if ( _irqPin > -1 )
+  {
+    // Drain the event queue. The button state machines are timed from when the IRQ fired, not from when we got here.
+    uint8_t tail = _irqTail;
+    while ( tail != __atomic_load_n(&_irqHead, __ATOMIC_ACQUIRE) )
+    {
+      processTouches(_events[tail]);
+      tail = (tail + 1) & (TOUCH_QUEUE_SIZE - 1);
+      // hands the slot back to the reader only once we are done with it
+      __atomic_store_n(&_irqTail, tail, __ATOMIC_RELEASE);
+    }
+
+    // IRQ still low with nothing queued means the reader is behind or an edge went missing - nudge it
+    if ( digitalRead(_irqPin) == LOW || __atomic_load_n(&_hasPending, __ATOMIC_RELAXED) )
+      xTaskNotifyGive( _task );
+  }
+  else
+  {
+    // No IRQ line, so poll - one I2C read of the touch status shared by every button
+    uint16_t touched = cap.touched();
+    TouchEvent event = { (uint32_t)micros(), touched, (uint16_t)(touched ^ _lastTouched) };
+    _lastTouched = touched;
+    processTouches(event);
+  }
+
   // Special case for first tick, to ensure it's the milllis() time for the first loop of the program
   if (last_touch == 0)
     last_touch = millis();
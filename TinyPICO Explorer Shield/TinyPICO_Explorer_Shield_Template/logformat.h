@@ -0,0 +1,70 @@
+#include <stdint.h>
+
+/*
+   Binary log file format
+   Shared by the logger (logger.h) and the host side decoder (../tools/log2csv.cpp), so only plain C++ in here.
+   Everything is little endian, as written by the ESP32.
+
+   A file is a run of 512 byte blocks, so every write lines up with an SD card sector:
+     block 0      LogFileHeader, zero padded
+     block 1..n   LogBlock - a block header followed by up to 31 fixed size records
+
+   Files are preallocated, so past the last block written there is whatever the card had in it before.
+   Every block carries the file's random session id and a sequence number, and the decoder stops at
+   the first block that doesn't continue the sequence.
+*/
+
+#define LOG_BLOCK_SIZE 512
+#define LOG_MAGIC 0x474C5054 // "TPLG"
+#define LOG_VERSION 1
+
+typedef enum
+{
+  LOG_REC_EMPTY = 0,  // unused slot at the end of a partly filled block
+  LOG_REC_ADS,        // v[0..3] ADS1015 channels 0-3, raw 12 bit readings
+  LOG_REC_ACCEL,      // v[0..2] LIS3DH x, y, z, 12 bit readings as delivered by TinyPICOAccel
+  LOG_REC_BATTERY,    // v[0] battery voltage in mV
+  LOG_REC_DROPPED,    // v[0] low, v[1] high 16 bits of the number of records lost to full buffers before this one
+} LogRecordType;
+
+struct LogRecord
+{
+  uint32_t timeUs;    // micros() when the sample was taken
+  uint8_t type;       // LogRecordType
+  uint8_t count;      // number of values used in v
+  int16_t v[5];
+};
+
+struct LogBlockHeader
+{
+  uint32_t magic;
+  uint32_t session;
+  uint32_t seq;       // 0 for the first block after the file header
+  uint16_t records;   // records used in this block
+  uint16_t reserved;
+};
+
+#define LOG_RECORDS_PER_BLOCK ((int)((LOG_BLOCK_SIZE - sizeof(LogBlockHeader)) / sizeof(LogRecord)))
+
+struct LogBlock
+{
+  LogBlockHeader header;
+  LogRecord records[LOG_RECORDS_PER_BLOCK];
+};
+
+struct LogFileHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t blockSize;
+  uint32_t session;
+  uint32_t fileIndex;
+  uint32_t startMillis;       // millis() when the file was opened
+  float accelMgPerDigit;      // scale for LOG_REC_ACCEL values
+  uint16_t adsFullScaleMv;    // scale for LOG_REC_ADS values - 2048 counts is full scale
+  uint16_t reserved;
+};
+
+static_assert(sizeof(LogRecord) == 16, "LogRecord must stay 16 bytes");
+static_assert(sizeof(LogBlock) == LOG_BLOCK_SIZE, "LogBlock must fill a block exactly");
+static_assert(sizeof(LogFileHeader) <= LOG_BLOCK_SIZE, "LogFileHeader must fit in a block");
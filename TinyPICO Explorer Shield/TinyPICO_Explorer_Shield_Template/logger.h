@@ -0,0 +1,353 @@
+#include <FS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "logformat.h"
+
+#define LOGGER_BUFFER_BLOCKS 8      // per buffer - 4KB, a quarter of a second of IMU and ADC at 1kHz
+#define LOGGER_FILE_BLOCKS 4096     // 2MB per file, preallocated when the file is opened
+#define LOGGER_TASK_STACK 4096
+#define LOGGER_TASK_PRIORITY 1
+
+/*
+   Binary data logger
+   Samples go into fixed 16 byte records (see logformat.h) packed into 512 byte blocks. There are two
+   buffers of blocks: the sketch fills one while a background task writes the other to the card, so a
+   slow SD write never holds up acquisition. If both buffers are full the record is dropped rather than
+   waiting, and the number lost is logged with the next record that fits.
+
+   Each file is grown to its full size when it is opened, so the FAT and directory entry don't change
+   while logging and every write is whole sectors going straight into already allocated clusters.
+   A new file is started when one is full.
+
+   Logging calls are safe from any task (not ISRs) and only ever copy 16 bytes.
+*/
+class DataLogger
+{
+  public:
+    // start logging to <prefix>NNNN.TPL, carrying on from the highest NNNN already on the card
+    bool begin(fs::FS &fs, const char *prefix = "/LOG", uint32_t fileBlocks = LOGGER_FILE_BLOCKS);
+    // writes out whatever has been logged and closes the file
+    void end();
+    bool isLogging() { return _open; }
+
+    // value scales recorded in the file header, for the decoder - set before begin()
+    void setScales(float accelMgPerDigit, uint16_t adsFullScaleMv)
+    {
+      _accelMgPerDigit = accelMgPerDigit;
+      _adsFullScaleMv = adsFullScaleMv;
+    }
+
+    bool logADS(uint32_t timeUs, const int16_t *channels, uint8_t count);
+    bool logAccel(uint32_t timeUs, int16_t x, int16_t y, int16_t z);
+    bool logBattery(uint32_t timeUs, uint16_t mv);
+
+    uint32_t getDropped() { return _droppedTotal; }
+    uint32_t getBlocksWritten() { return _blocksWritten; }
+    // NNNN of the file being written
+    uint32_t getFileIndex() { return _fileIndex - 1; }
+
+  private:
+    struct Handoff
+    {
+      uint8_t buffer;
+      uint8_t blocks;     // 0 tells the task to close up and stop
+    };
+
+    bool append(uint8_t type, uint32_t timeUs, const int16_t *v, uint8_t count);
+    int put(uint8_t type, uint32_t timeUs, const int16_t *v, uint8_t count);
+    int sealBlock();
+    bool openNextFile();
+    void writeBuffer(const Handoff &h);
+    static void writerTask(void *arg);
+
+    LogBlock _buffers[2][LOGGER_BUFFER_BLOCKS];
+    volatile bool _busy[2] = { false, false };  // with the writer task
+    uint8_t _fill = 0;      // buffer being filled
+    uint8_t _block = 0;     // block being filled in it
+    uint8_t _record = 0;    // next record in that block
+    uint32_t _seq = 0;      // running count of blocks filled
+    volatile bool _open = false;
+    uint32_t _dropped = 0;  // not logged yet
+    uint32_t _droppedTotal = 0;
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    fs::FS *_fs = nullptr;
+    fs::File _file;
+    const char *_prefix;
+    uint32_t _fileBlocks;
+    uint32_t _fileIndex = 0;
+    uint32_t _fileUsed = 0;       // blocks written to the current file, including the header
+    uint32_t _session = 0;
+    uint32_t _seqBase = 0;        // _seq of the first block in the current file
+    uint32_t _blocksWritten = 0;
+    float _accelMgPerDigit = 0;
+    uint16_t _adsFullScaleMv = 0;
+
+    TaskHandle_t _task = nullptr;
+    TaskHandle_t _closer = nullptr;
+    QueueHandle_t _queue = nullptr;
+};
+
+bool DataLogger::begin(fs::FS &fs, const char *prefix, uint32_t fileBlocks)
+{
+  if (_task)
+    return false;
+
+  _fs = &fs;
+  _prefix = prefix;
+  _fileBlocks = max(fileBlocks, (uint32_t)LOGGER_BUFFER_BLOCKS + 1);
+
+  // carry on after the last file already there
+  char name[32];
+  for (_fileIndex = 0; _fileIndex < 10000; _fileIndex++)
+  {
+    snprintf(name, sizeof(name), "%s%04u.TPL", _prefix, _fileIndex);
+    if (!_fs->exists(name))
+      break;
+  }
+
+  if (!openNextFile())
+    return false;
+
+  _fill = _block = _record = 0;
+  _seq = 0;
+  _busy[0] = _busy[1] = false;
+  _dropped = _droppedTotal = _blocksWritten = 0;
+  memset(_buffers, 0, sizeof(_buffers));
+
+  _queue = xQueueCreate(2, sizeof(Handoff));
+  if (!_queue || xTaskCreate(writerTask, "Logger", LOGGER_TASK_STACK, this, LOGGER_TASK_PRIORITY, &_task) != pdPASS)
+  {
+    _file.close();
+    _task = nullptr;
+    return false;
+  }
+  _open = true;
+  return true;
+}
+
+void DataLogger::end()
+{
+  if (!_task)
+    return;
+
+  Handoff h = { 0, 0 };
+  portENTER_CRITICAL(&_mux);
+  // nothing more can be added after this, and the part filled block goes out too
+  _open = false;
+  int full = sealBlock();
+  if (full >= 0)
+  {
+    h.buffer = full;
+    h.blocks = LOGGER_BUFFER_BLOCKS;
+  }
+  else
+  {
+    h.buffer = _fill;
+    h.blocks = _block;
+    _busy[_fill] = true;
+  }
+  portEXIT_CRITICAL(&_mux);
+
+  if (h.blocks > 0)
+    xQueueSend(_queue, &h, portMAX_DELAY);
+
+  // then the stop message, and wait for the task to close the file
+  _closer = xTaskGetCurrentTaskHandle();
+  h.blocks = 0;
+  xQueueSend(_queue, &h, portMAX_DELAY);
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+  vQueueDelete(_queue);
+  _queue = nullptr;
+  _task = nullptr;
+}
+
+bool DataLogger::logADS(uint32_t timeUs, const int16_t *channels, uint8_t count)
+{
+  return append(LOG_REC_ADS, timeUs, channels, min(count, (uint8_t)4));
+}
+
+bool DataLogger::logAccel(uint32_t timeUs, int16_t x, int16_t y, int16_t z)
+{
+  int16_t v[3] = { x, y, z };
+  return append(LOG_REC_ACCEL, timeUs, v, 3);
+}
+
+bool DataLogger::logBattery(uint32_t timeUs, uint16_t mv)
+{
+  int16_t v = (int16_t)mv;
+  return append(LOG_REC_BATTERY, timeUs, &v, 1);
+}
+
+bool DataLogger::append(uint8_t type, uint32_t timeUs, const int16_t *v, uint8_t count)
+{
+  int handoff = -1;
+  bool logged = false;
+
+  portENTER_CRITICAL(&_mux);
+  if (_open && !_busy[_fill] && _dropped)
+  {
+    int16_t lost[2] = { (int16_t)(_dropped & 0xFFFF), (int16_t)(_dropped >> 16) };
+    _dropped = 0;
+    handoff = put(LOG_REC_DROPPED, timeUs, lost, 2);
+  }
+
+  // that could have filled the buffer, and the other one may still be waiting on the card
+  if (_open && !_busy[_fill])
+  {
+    int full = put(type, timeUs, v, count);
+    if (full >= 0)
+      handoff = full;
+    logged = true;
+  }
+  else if (_open)
+  {
+    _dropped++;
+    _droppedTotal++;
+  }
+  portEXIT_CRITICAL(&_mux);
+
+  // no FreeRTOS calls inside a critical section
+  if (handoff >= 0)
+  {
+    Handoff h = { (uint8_t)handoff, LOGGER_BUFFER_BLOCKS };
+    xQueueSend(_queue, &h, 0);
+  }
+  return logged;
+}
+
+// With _mux held and room in the current block. Returns the buffer to hand over if this filled it, or -1.
+int DataLogger::put(uint8_t type, uint32_t timeUs, const int16_t *v, uint8_t count)
+{
+  LogRecord &r = _buffers[_fill][_block].records[_record];
+  r.timeUs = timeUs;
+  r.type = type;
+  r.count = count;
+  for (int i = 0; i < 5; i++)
+    r.v[i] = i < count ? v[i] : 0;
+
+  if (++_record == LOG_RECORDS_PER_BLOCK)
+    return sealBlock();
+  return -1;
+}
+
+// With _mux held. Closes off the current block, and if that was the last block in the buffer
+// hands the buffer over and returns its index, otherwise returns -1.
+int DataLogger::sealBlock()
+{
+  if (_record > 0)
+  {
+    LogBlockHeader &h = _buffers[_fill][_block].header;
+    h.magic = LOG_MAGIC;
+    h.seq = _seq++;
+    h.records = _record;
+    h.reserved = 0;
+    // the session is filled in by the writer, which knows which file the block ends up in
+    for (int i = _record; i < LOG_RECORDS_PER_BLOCK; i++)
+      _buffers[_fill][_block].records[i].type = LOG_REC_EMPTY;
+    _record = 0;
+    _block++;
+  }
+
+  if (_block < LOGGER_BUFFER_BLOCKS)
+    return -1;
+
+  int full = _fill;
+  _busy[full] = true;
+  _fill = 1 - _fill;
+  _block = 0;
+  return full;
+}
+
+bool DataLogger::openNextFile()
+{
+  if (_file)
+    _file.close();
+
+  char name[32];
+  snprintf(name, sizeof(name), "%s%04u.TPL", _prefix, _fileIndex);
+  _file = _fs->open(name, FILE_WRITE);
+  if (!_file)
+    return false;
+
+  // Seeking past the end grows the file, which allocates every cluster now. The clusters are
+  // contiguous on a card that isn't fragmented, and nothing in the FAT changes after this.
+  uint32_t size = _fileBlocks * LOG_BLOCK_SIZE;
+  if (!_file.seek(size - 1) || _file.write((uint8_t)0) != 1 || !_file.seek(0))
+  {
+    _file.close();
+    return false;
+  }
+
+  _session = esp_random();
+
+  uint8_t block[LOG_BLOCK_SIZE];
+  memset(block, 0, sizeof(block));
+  LogFileHeader *fh = (LogFileHeader *)block;
+  fh->magic = LOG_MAGIC;
+  fh->version = LOG_VERSION;
+  fh->blockSize = LOG_BLOCK_SIZE;
+  fh->session = _session;
+  fh->fileIndex = _fileIndex;
+  fh->startMillis = millis();
+  fh->accelMgPerDigit = _accelMgPerDigit;
+  fh->adsFullScaleMv = _adsFullScaleMv;
+
+  _fileUsed = 1;
+  _fileIndex++;
+  return _file.write(block, sizeof(block)) == sizeof(block);
+}
+
+void DataLogger::writeBuffer(const Handoff &h)
+{
+  LogBlock *blocks = _buffers[h.buffer];
+  uint8_t done = 0;
+
+  while (done < h.blocks)
+  {
+    if (_fileUsed >= _fileBlocks && !openNextFile())
+      break;
+
+    uint8_t n = min((uint32_t)(h.blocks - done), _fileBlocks - _fileUsed);
+
+    // sequence numbers restart with each file, so the decoder can read any file on its own
+    for (int i = 0; i < n; i++)
+    {
+      blocks[done + i].header.session = _session;
+      if (_fileUsed + i == 1)
+        _seqBase = blocks[done + i].header.seq;
+      blocks[done + i].header.seq -= _seqBase;
+    }
+
+    if (_file.write((uint8_t *)&blocks[done], n * LOG_BLOCK_SIZE) != n * LOG_BLOCK_SIZE)
+      break;
+
+    _fileUsed += n;
+    _blocksWritten += n;
+    done += n;
+  }
+
+  // the file size doesn't change, so this only pushes out the cached sector
+  _file.flush();
+  memset(blocks, 0, sizeof(_buffers[0]));
+  _busy[h.buffer] = false;
+}
+
+void DataLogger::writerTask(void *arg)
+{
+  DataLogger *self = (DataLogger *)arg;
+  Handoff h;
+
+  while (xQueueReceive(self->_queue, &h, portMAX_DELAY) == pdTRUE)
+  {
+    if (h.blocks == 0)
+      break;
+    self->writeBuffer(h);
+  }
+
+  self->_file.close();
+  xTaskNotifyGive(self->_closer);
+  vTaskDelete(NULL);
+}
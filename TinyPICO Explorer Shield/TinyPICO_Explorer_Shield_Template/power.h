@@ -0,0 +1,265 @@
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include <driver/rtc_io.h>
+
+#define POWER_MAX_WAKE_PINS 4
+#define POWER_MAX_WAKE_TOUCH 2
+#define POWER_RETAINED_BYTES 128
+#define POWER_RETAINED_MAGIC 0x50574D31 // "PWM1"
+// longest light sleep taken instead of a deep sleep no wake source could be set up for
+#define POWER_FALLBACK_SLEEP_MS 1000
+
+typedef enum
+{
+  POWER_LIGHT_SLEEP,
+  POWER_DEEP_SLEEP
+} PowerSleepKind;
+
+typedef void (*powerHookFn)(PowerSleepKind kind);
+
+// Kept in RTC slow memory, so it survives light and deep sleep (but not a reset or power cycle)
+struct PowerRetained
+{
+  uint32_t magic;
+  uint32_t deepSleeps;
+  uint32_t lightSleeps;
+  uint16_t appSize;
+  uint8_t app[POWER_RETAINED_BYTES];
+};
+
+RTC_DATA_ATTR PowerRetained powerRetained;
+
+/*
+   Power manager
+   Picks light sleep for short idle periods - RAM, the display contents and every peripheral stay as
+   they are and loop() carries on where it left off - and deep sleep for long ones. Application state
+   saved with save() is restored after a deep sleep wake, so setup() can skip the splash screen and
+   boot sound and go straight back to where it was.
+
+   Wake sources are GPIO pins (MCP23017 INT, MPR121 IRQ...), touch pads and, for light sleep, a timer.
+   Deep sleep wakes through ext1, which works alongside touch wakeup (ext0 doesn't), so only RTC capable
+   IOs count. ext1 can wake on any of several pins going high but only on all of them going low, so it
+   takes every active high pin, or just the first active low one.
+*/
+class PowerManager
+{
+  public:
+    // call first thing in setup()
+    void begin();
+
+    // woke from our own deep sleep with retained state intact
+    bool resumed() { return _resumed; }
+    esp_sleep_wakeup_cause_t wakeCause() { return _cause; }
+
+    // rearmMode is the attachInterrupt mode the sketch uses on this pin, if any. Light sleep borrows
+    // the pin's interrupt trigger as a level wake, so it is put back to this after waking.
+    // Pins that only need servicing while we're up (a sensor FIFO...) should pass deep = false.
+    bool addWakePin(int gpio, int activeLevel, int rearmMode = 0, bool deep = true);
+    bool addWakeTouch(int touchPad, uint16_t threshold);
+
+    // expected idle periods at least this long go to deep sleep
+    void setDeepSleepThreshold(uint32_t ms) { _deepThresholdMs = ms; }
+
+    void onSleep(powerHookFn fn) { _sleepFn = fn; }
+    void onWake(powerHookFn fn) { _wakeFn = fn; }
+
+    // Sleep for up to expectedIdleMs, or until a wake source fires. Only returns from light sleep.
+    // The sleep hook runs once the wake sources are set up, so a deep sleep hook only runs when the
+    // deep sleep is really going to happen.
+    PowerSleepKind sleep(uint32_t expectedIdleMs);
+
+    // Application state that should survive deep sleep
+    template <typename T> bool save(const T &state);
+    template <typename T> bool restore(T &state);
+
+    uint32_t getDeepSleeps() { return powerRetained.deepSleeps; }
+    uint32_t getLightSleeps() { return powerRetained.lightSleeps; }
+
+  private:
+    static void touchWakeCallback() {}
+    void lightSleep(uint32_t ms);
+    bool armDeepSleep();
+
+    struct WakePin
+    {
+      int gpio;
+      int activeLevel;
+      int rearmMode;
+      bool deep;
+    };
+
+    WakePin _pins[POWER_MAX_WAKE_PINS];
+    uint8_t _numPins = 0;
+    uint8_t _numTouch = 0;
+
+    uint32_t _deepThresholdMs = 30000;
+    powerHookFn _sleepFn = nullptr;
+    powerHookFn _wakeFn = nullptr;
+
+    bool _resumed = false;
+    esp_sleep_wakeup_cause_t _cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+};
+
+void PowerManager::begin()
+{
+  _cause = esp_sleep_get_wakeup_cause();
+
+  // RTC memory is only valid if we put it there before sleeping
+  _resumed = _cause != ESP_SLEEP_WAKEUP_UNDEFINED && powerRetained.magic == POWER_RETAINED_MAGIC;
+  if (!_resumed)
+  {
+    memset(&powerRetained, 0, sizeof(powerRetained));
+    powerRetained.magic = POWER_RETAINED_MAGIC;
+  }
+}
+
+bool PowerManager::addWakePin(int gpio, int activeLevel, int rearmMode, bool deep)
+{
+  if (gpio < 0 || _numPins >= POWER_MAX_WAKE_PINS)
+    return false;
+
+  _pins[_numPins++] = { gpio, activeLevel, rearmMode, deep };
+  return true;
+}
+
+bool PowerManager::addWakeTouch(int touchPad, uint16_t threshold)
+{
+  if (_numTouch >= POWER_MAX_WAKE_TOUCH)
+    return false;
+
+  touchAttachInterrupt(touchPad, touchWakeCallback, threshold);
+  _numTouch++;
+  return true;
+}
+
+template <typename T> bool PowerManager::save(const T &state)
+{
+  static_assert(sizeof(T) <= POWER_RETAINED_BYTES, "Application state is too big for the RTC retained area");
+  memcpy(powerRetained.app, &state, sizeof(T));
+  powerRetained.appSize = sizeof(T);
+  return true;
+}
+
+template <typename T> bool PowerManager::restore(T &state)
+{
+  // a different build may have saved a different layout
+  if (!_resumed || powerRetained.appSize != sizeof(T))
+    return false;
+
+  memcpy(&state, powerRetained.app, sizeof(T));
+  return true;
+}
+
+PowerSleepKind PowerManager::sleep(uint32_t expectedIdleMs)
+{
+  PowerSleepKind kind = expectedIdleMs >= _deepThresholdMs ? POWER_DEEP_SLEEP : POWER_LIGHT_SLEEP;
+
+  if (kind == POWER_DEEP_SLEEP)
+  {
+    if (armDeepSleep())
+    {
+      if (_sleepFn)
+        _sleepFn(kind);
+
+      powerRetained.deepSleeps++;
+      Serial.println("Going to sleep now");
+      Serial.flush();
+      esp_deep_sleep_start(); // doesn't return
+    }
+
+    // Nothing could wake us from deep sleep, so light sleep instead, briefly enough that loop()
+    // keeps running and tries again
+    kind = POWER_LIGHT_SLEEP;
+    expectedIdleMs = min(expectedIdleMs, (uint32_t)POWER_FALLBACK_SLEEP_MS);
+  }
+
+  if (_sleepFn)
+    _sleepFn(kind);
+
+  lightSleep(expectedIdleMs);
+
+  if (_wakeFn)
+    _wakeFn(kind);
+
+  return kind;
+}
+
+void PowerManager::lightSleep(uint32_t ms)
+{
+  esp_sleep_enable_timer_wakeup((uint64_t)ms * 1000);
+
+  if (_numTouch > 0)
+    esp_sleep_enable_touchpad_wakeup();
+
+  if (_numPins > 0)
+  {
+    for (int i = 0; i < _numPins; i++)
+      gpio_wakeup_enable((gpio_num_t)_pins[i].gpio, _pins[i].activeLevel ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+  }
+
+  // make sure anything we printed is out before the UART clock stops
+  Serial.flush();
+  esp_light_sleep_start();
+  powerRetained.lightSleeps++;
+
+  for (int i = 0; i < _numPins; i++)
+  {
+    gpio_wakeup_disable((gpio_num_t)_pins[i].gpio);
+    if (_pins[i].rearmMode)
+      gpio_set_intr_type((gpio_num_t)_pins[i].gpio, (gpio_int_type_t)_pins[i].rearmMode);
+  }
+
+  esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
+}
+
+// sets up every deep sleep wake source it can, and returns false (with none left enabled) if there wasn't one
+bool PowerManager::armDeepSleep()
+{
+  bool armed = false;
+  if (_numTouch > 0)
+  {
+    if (esp_sleep_enable_touchpad_wakeup() == ESP_OK)
+      armed = true;
+    else
+      Serial.println("Touch wakeup failed");
+  }
+
+  // the first RTC capable pin sets the level, the others join it if ext1 can take them
+  uint64_t mask = 0;
+  int level = -1;
+  for (int i = 0; i < _numPins; i++)
+  {
+    gpio_num_t gpio = (gpio_num_t)_pins[i].gpio;
+    if (!_pins[i].deep || !rtc_gpio_is_valid_gpio(gpio))
+      continue;
+
+    if (level < 0)
+      level = _pins[i].activeLevel;
+    if (_pins[i].activeLevel != level || (level == LOW && mask != 0))
+      continue;
+
+    // open drain interrupt outputs need the pull up kept on while the rest of the chip is off
+    if (level == LOW)
+    {
+      rtc_gpio_pullup_en(gpio);
+      rtc_gpio_pulldown_dis(gpio);
+    }
+    mask |= 1ULL << gpio;
+  }
+
+  if (mask != 0)
+  {
+    if (level == LOW)
+      esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+
+    if (esp_sleep_enable_ext1_wakeup(mask, level == LOW ? ESP_EXT1_WAKEUP_ALL_LOW : ESP_EXT1_WAKEUP_ANY_HIGH) == ESP_OK)
+      armed = true;
+    else
+      Serial.println("Pin wakeup failed");
+  }
+
+  if (!armed)
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
+  return armed;
+}
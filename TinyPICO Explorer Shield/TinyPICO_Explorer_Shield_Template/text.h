@@ -0,0 +1,367 @@
+#include <Adafruit_GFX.h>
+
+/*
+   Glyph cached text layer
+
+   Adafruit_GFX measures text by walking every character through getTextBounds() and draws the
+   built in font one pixel at a time. Here we render each printable glyph once into a 1-bit canvas,
+   store it as horizontal runs (spans) plus its advance width, and from then on measure with a table
+   lookup and draw with one fillRect() per span. Nothing on the measure/draw path touches the heap.
+
+   Glyph sets are shared per font. The text size is applied at draw time, so one set serves all sizes.
+*/
+
+#define TEXT_FIRST_CHAR 32
+#define TEXT_LAST_CHAR 126
+#define TEXT_NUM_GLYPHS (TEXT_LAST_CHAR - TEXT_FIRST_CHAR + 1)
+#define TEXT_MAX_GLYPH_SETS 2
+#define TEXT_MAX_SPANS 1536 // per glyph set - the built in font needs ~700
+
+typedef enum
+{
+  ALIGN_LEFT,
+  ALIGN_CENTER,
+  ALIGN_RIGHT
+} TextAlign;
+
+struct GlyphSpan
+{
+  uint8_t row;
+  uint8_t x;
+  uint8_t len;
+};
+
+struct GlyphSet
+{
+  const GFXfont *font = nullptr;
+  bool ready = false;
+  int8_t originX = 0; // glyph cell offset from the cursor, in font pixels
+  int8_t originY = 0; // for GFX fonts this is relative to the baseline, for the built in font it's 0
+  uint8_t height = 0; // glyph cell height in font pixels
+  uint8_t advance[TEXT_NUM_GLYPHS];
+  uint16_t first[TEXT_NUM_GLYPHS + 1]; // index of each glyph's first span, plus an end marker
+  uint16_t numSpans = 0;
+  GlyphSpan spans[TEXT_MAX_SPANS];
+};
+
+static GlyphSet _glyphSets[TEXT_MAX_GLYPH_SETS];
+
+class TextRenderer
+{
+  public:
+    TextRenderer(Adafruit_GFX &d, const GFXfont *font = nullptr, uint8_t size = 1);
+
+    bool begin(void);
+
+    uint16_t measure(const char *text) const { return measure(text, strlen(text)); }
+    uint16_t measure(const char *text, size_t len) const;
+    uint16_t charWidth(char c) const;
+    uint16_t height(void) const { return _set ? _set->height * _size : 0; }
+
+    // y is always the top of the text box, regardless of font
+    int16_t draw(const char *text, int16_t x, int16_t y, uint16_t color, TextAlign align = ALIGN_LEFT) { return draw(text, strlen(text), x, y, color, align); }
+    int16_t draw(const char *text, size_t len, int16_t x, int16_t y, uint16_t color, TextAlign align = ALIGN_LEFT);
+    void drawCentered(const char *text, int16_t centerX, int16_t centerY, uint16_t color);
+
+    // Draw a single glyph cell, clearing its background first
+    void drawCell(char c, int16_t x, int16_t y, uint16_t color, uint16_t bg);
+    void clearBox(int16_t x, int16_t y, uint16_t w, uint16_t bg) { _d.fillRect(x, y, w, height(), bg); }
+
+  private:
+    bool buildGlyphSet(GlyphSet *set);
+    void drawGlyph(char c, int16_t x, int16_t y, uint16_t color);
+
+    Adafruit_GFX &_d;
+    const GFXfont *_font;
+    uint8_t _size;
+    GlyphSet *_set = nullptr;
+};
+
+TextRenderer::TextRenderer(Adafruit_GFX &d, const GFXfont *font, uint8_t size) : _d(d), _font(font), _size(size < 1 ? 1 : size)
+{
+}
+
+bool TextRenderer::begin()
+{
+  // Re-use an existing glyph set for this font if there is one
+  for ( int i = 0; i < TEXT_MAX_GLYPH_SETS; i++ )
+  {
+    if ( _glyphSets[i].ready && _glyphSets[i].font == _font )
+    {
+      _set = &_glyphSets[i];
+      return true;
+    }
+  }
+
+  for ( int i = 0; i < TEXT_MAX_GLYPH_SETS; i++ )
+  {
+    if ( !_glyphSets[i].ready )
+    {
+      if ( !buildGlyphSet(&_glyphSets[i]) )
+        return false;
+      _set = &_glyphSets[i];
+      return true;
+    }
+  }
+
+  Serial.println("Error - TextRenderer out of glyph sets!");
+  return false;
+}
+
+bool TextRenderer::buildGlyphSet(GlyphSet *set)
+{
+  int16_t minX = 0, minY = 0, maxX = 6, maxY = 8; // built in font cell
+
+  if ( _font )
+  {
+    minX = 127; minY = 127; maxX = -128; maxY = -128;
+    for ( uint8_t c = TEXT_FIRST_CHAR; c <= TEXT_LAST_CHAR; c++ )
+    {
+      if ( c < _font->first || c > _font->last )
+        continue;
+      GFXglyph *g = &_font->glyph[c - _font->first];
+      minX = min(minX, (int16_t)g->xOffset);
+      minY = min(minY, (int16_t)g->yOffset);
+      maxX = max(maxX, (int16_t)(g->xOffset + g->width));
+      maxY = max(maxY, (int16_t)(g->yOffset + g->height));
+    }
+    if ( maxX <= minX || maxY <= minY )
+      return false;
+  }
+
+  // Scratch canvas, only used while building the set
+  GFXcanvas1 canvas(maxX - minX, maxY - minY);
+  if ( !canvas.getBuffer() )
+    return false;
+  canvas.setFont(_font);
+  canvas.setTextSize(1);
+
+  set->font = _font;
+  set->originX = minX;
+  set->originY = minY;
+  set->height = maxY - minY;
+  set->numSpans = 0;
+
+  for ( uint8_t c = TEXT_FIRST_CHAR; c <= TEXT_LAST_CHAR; c++ )
+  {
+    uint8_t idx = c - TEXT_FIRST_CHAR;
+    set->first[idx] = set->numSpans;
+
+    if ( _font )
+    {
+      if ( c < _font->first || c > _font->last )
+      {
+        set->advance[idx] = 0;
+        continue;
+      }
+      set->advance[idx] = _font->glyph[c - _font->first].xAdvance;
+    }
+    else
+    {
+      set->advance[idx] = 6;
+    }
+
+    canvas.fillScreen(0);
+    canvas.drawChar(-minX, -minY, c, 1, 1, 1);
+
+    for ( int16_t row = 0; row < canvas.height(); row++ )
+    {
+      int16_t start = -1;
+      for ( int16_t x = 0; x <= canvas.width(); x++ )
+      {
+        bool on = ( x < canvas.width() ) && canvas.getPixel(x, row);
+        if ( on && start < 0 )
+        {
+          start = x;
+        }
+        else if ( !on && start >= 0 )
+        {
+          if ( set->numSpans >= TEXT_MAX_SPANS )
+          {
+            Serial.println("Error - TextRenderer span pool exhausted!");
+            return false;
+          }
+          set->spans[set->numSpans++] = { (uint8_t)row, (uint8_t)start, (uint8_t)(x - start) };
+          start = -1;
+        }
+      }
+    }
+  }
+  set->first[TEXT_NUM_GLYPHS] = set->numSpans;
+  set->ready = true;
+
+  return true;
+}
+
+uint16_t TextRenderer::charWidth(char c) const
+{
+  if ( !_set || c < TEXT_FIRST_CHAR || c > TEXT_LAST_CHAR )
+    return 0;
+  return _set->advance[c - TEXT_FIRST_CHAR] * _size;
+}
+
+uint16_t TextRenderer::measure(const char *text, size_t len) const
+{
+  uint16_t w = 0;
+  for ( size_t i = 0; i < len; i++ )
+    w += charWidth(text[i]);
+  return w;
+}
+
+void TextRenderer::drawGlyph(char c, int16_t x, int16_t y, uint16_t color)
+{
+  uint8_t idx = c - TEXT_FIRST_CHAR;
+  x += _set->originX * _size;
+  for ( uint16_t s = _set->first[idx]; s < _set->first[idx + 1]; s++ )
+  {
+    const GlyphSpan &span = _set->spans[s];
+    _d.writeFillRect(x + span.x * _size, y + span.row * _size, span.len * _size, _size, color);
+  }
+}
+
+int16_t TextRenderer::draw(const char *text, size_t len, int16_t x, int16_t y, uint16_t color, TextAlign align)
+{
+  if ( !_set )
+    return x;
+
+  if ( align == ALIGN_CENTER )
+    x -= measure(text, len) / 2;
+  else if ( align == ALIGN_RIGHT )
+    x -= measure(text, len);
+
+  _d.startWrite();
+  for ( size_t i = 0; i < len; i++ )
+  {
+    char c = text[i];
+    if ( c < TEXT_FIRST_CHAR || c > TEXT_LAST_CHAR )
+      continue;
+    drawGlyph(c, x, y, color);
+    x += _set->advance[c - TEXT_FIRST_CHAR] * _size;
+  }
+  _d.endWrite();
+
+  // return the x position following the last glyph so callers can chain draws
+  return x;
+}
+
+void TextRenderer::drawCentered(const char *text, int16_t centerX, int16_t centerY, uint16_t color)
+{
+  draw(text, strlen(text), centerX, centerY - height() / 2, color, ALIGN_CENTER);
+}
+
+void TextRenderer::drawCell(char c, int16_t x, int16_t y, uint16_t color, uint16_t bg)
+{
+  if ( !_set || c < TEXT_FIRST_CHAR || c > TEXT_LAST_CHAR )
+    return;
+
+  _d.startWrite();
+  _d.writeFillRect(x, y, charWidth(c), height(), bg);
+  drawGlyph(c, x, y, color);
+  _d.endWrite();
+}
+
+
+/*
+   Numeric field that updates in place
+
+   Keeps the text that is currently on screen and only redraws the glyph cells that differ, so a
+   counter ticking from 10 to 9 redraws one or two cells instead of clearing and redrawing a line.
+*/
+
+#define NUMERIC_FIELD_MAX_CHARS 11 // "-2147483648"
+
+class NumericField
+{
+  public:
+    NumericField(TextRenderer &text, int16_t x, int16_t y, TextAlign align, uint16_t color, uint16_t bg);
+
+    void setPosition(int16_t x, int16_t y);
+    void set(int32_t value);
+    void clear(void);
+    void invalidate(void) { _shownLen = 0; }
+
+  private:
+    int16_t left(uint16_t width) const;
+
+    TextRenderer &_text;
+    int16_t _x, _y;
+    TextAlign _align;
+    uint16_t _color, _bg;
+    char _shown[NUMERIC_FIELD_MAX_CHARS];
+    uint8_t _shownLen = 0;
+    uint16_t _shownWidth = 0;
+};
+
+NumericField::NumericField(TextRenderer &text, int16_t x, int16_t y, TextAlign align, uint16_t color, uint16_t bg) : _text(text), _x(x), _y(y), _align(align), _color(color), _bg(bg)
+{
+}
+
+void NumericField::setPosition(int16_t x, int16_t y)
+{
+  _x = x;
+  _y = y;
+  invalidate();
+}
+
+int16_t NumericField::left(uint16_t width) const
+{
+  if ( _align == ALIGN_RIGHT )
+    return _x - width;
+  if ( _align == ALIGN_CENTER )
+    return _x - width / 2;
+  return _x;
+}
+
+void NumericField::set(int32_t value)
+{
+  // Format right to left into a local buffer - no printf, no String
+  char buf[NUMERIC_FIELD_MAX_CHARS];
+  uint8_t pos = NUMERIC_FIELD_MAX_CHARS;
+  uint32_t v = value < 0 ? -(uint32_t)value : value;
+  do
+  {
+    buf[--pos] = '0' + ( v % 10 );
+    v /= 10;
+  } while ( v );
+  if ( value < 0 )
+    buf[--pos] = '-';
+
+  const char *digits = &buf[pos];
+  uint8_t len = NUMERIC_FIELD_MAX_CHARS - pos;
+  uint16_t width = _text.measure(digits, len);
+
+  if ( _shownLen == len && _shownWidth == width )
+  {
+    // Same footprint, so only touch the cells that changed
+    int16_t x = left(width);
+    for ( uint8_t i = 0; i < len; i++ )
+    {
+      if ( digits[i] != _shown[i] )
+        _text.drawCell(digits[i], x, _y, _color, _bg);
+      x += _text.charWidth(digits[i]);
+    }
+  }
+  else
+  {
+    clear();
+    int16_t x = left(width);
+    for ( uint8_t i = 0; i < len; i++ )
+    {
+      _text.drawCell(digits[i], x, _y, _color, _bg);
+      x += _text.charWidth(digits[i]);
+    }
+  }
+
+  memcpy(_shown, digits, len);
+  _shownLen = len;
+  _shownWidth = width;
+}
+
+void NumericField::clear()
+{
+  // wipe whatever we drew last time
+  if ( _shownLen > 0 )
+    _text.clearBox(left(_shownWidth), _y, _shownWidth, _bg);
+  _shownLen = 0;
+  _shownWidth = 0;
+}
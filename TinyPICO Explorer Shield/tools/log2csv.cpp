@@ -0,0 +1,130 @@
+/*
+   Decodes TinyPICO Explorer binary log files (LOGnnnn.TPL) to CSV
+
+   Build:   g++ -O2 -o log2csv log2csv.cpp
+   Usage:   log2csv LOG0000.TPL [LOG0001.TPL ...] > log.csv
+
+   One row per record:
+     time_us,type,v0,v1,v2,v3
+   with the values scaled using the file header - mV for ADS1015 channels and the battery, g for the
+   accelerometer, and a count for dropped records. Times are unwrapped, so they keep counting up
+   past micros() rolling over at 71 minutes.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "../TinyPICO_Explorer_Shield_Template/logformat.h"
+
+static const char *typeNames[] = { "empty", "ads", "accel", "battery", "dropped" };
+
+struct Clock
+{
+  bool started = false;
+  uint32_t last = 0;
+  uint64_t high = 0;
+
+  uint64_t unwrap(uint32_t t)
+  {
+    // records can be a little out of order across sources, so only a big backwards step is a wrap
+    if (started && t < last && last - t > 0x80000000UL)
+      high += 0x100000000ULL;
+    started = true;
+    last = t;
+    return high + t;
+  }
+};
+
+static void printRecord(const LogRecord &r, const LogFileHeader &fh, Clock &clock)
+{
+  if (r.type == LOG_REC_EMPTY || r.type > LOG_REC_DROPPED)
+    return;
+
+  printf("%llu,%s", (unsigned long long)clock.unwrap(r.timeUs), typeNames[r.type]);
+
+  switch (r.type)
+  {
+    case LOG_REC_ADS:
+      for (int i = 0; i < r.count; i++)
+        printf(",%.1f", r.v[i] * (float)fh.adsFullScaleMv / 2048.0f);
+      break;
+
+    case LOG_REC_ACCEL:
+      for (int i = 0; i < 3; i++)
+        printf(",%.4f", r.v[i] * fh.accelMgPerDigit / 1000.0f);
+      break;
+
+    case LOG_REC_BATTERY:
+      printf(",%u", (uint16_t)r.v[0]);
+      break;
+
+    case LOG_REC_DROPPED:
+      printf(",%u", (uint16_t)r.v[0] | ((uint32_t)(uint16_t)r.v[1] << 16));
+      break;
+  }
+  printf("\n");
+}
+
+static bool decodeFile(const char *path, Clock &clock)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+  {
+    fprintf(stderr, "%s: can't open\n", path);
+    return false;
+  }
+
+  uint8_t block[LOG_BLOCK_SIZE];
+  LogFileHeader fh;
+
+  if (fread(block, 1, LOG_BLOCK_SIZE, f) != LOG_BLOCK_SIZE)
+  {
+    fprintf(stderr, "%s: too short\n", path);
+    fclose(f);
+    return false;
+  }
+  memcpy(&fh, block, sizeof(fh));
+  if (fh.magic != LOG_MAGIC || fh.version != LOG_VERSION || fh.blockSize != LOG_BLOCK_SIZE)
+  {
+    fprintf(stderr, "%s: not a version %d log file\n", path, LOG_VERSION);
+    fclose(f);
+    return false;
+  }
+
+  // the file is preallocated, so the log ends at the first block that isn't the next one in this session
+  uint32_t seq = 0;
+  LogBlock b;
+  while (fread(&b, 1, sizeof(b), f) == sizeof(b))
+  {
+    if (b.header.magic != LOG_MAGIC || b.header.session != fh.session || b.header.seq != seq)
+      break;
+    if (b.header.records > LOG_RECORDS_PER_BLOCK)
+      break;
+
+    for (int i = 0; i < b.header.records; i++)
+      printRecord(b.records[i], fh, clock);
+    seq++;
+  }
+
+  fprintf(stderr, "%s: %u blocks\n", path, seq);
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s LOGnnnn.TPL [...] > log.csv\n", argv[0]);
+    return 1;
+  }
+
+  Clock clock;
+  bool ok = true;
+
+  printf("time_us,type,v0,v1,v2,v3\n");
+  for (int i = 1; i < argc; i++)
+    ok &= decodeFile(argv[i], clock);
+
+  return ok ? 0 : 1;
+}
@@ -16,6 +16,9 @@
 // ---------------------------------------------------------------------------
 
 #include "TinyPICO.h"
+#include "TinyPICOColor.h"
+#include "TinyPICOADC.h"
+#include "TinyPICOProfiler.h"
 #include <SPI.h>
 #include "driver/adc.h"
 #include "esp_adc_cal.h"
@@ -40,7 +43,11 @@ TinyPICO::TinyPICO()
         pixel[i] = 0;
 
     isInit = false;
-    brightness = 128;
+    adcEngine = NULL;
+    adcChannel = -1;
+    profiler = NULL;
+    profilerMarker = -1;
+    brightness = 127;
     colorRotation = 0;
     nextRotation = 0;
 }
@@ -53,19 +60,15 @@ TinyPICO::~TinyPICO()
 
 void TinyPICO::DotStar_SetBrightness(uint8_t b)
 {
-    // Stored brightness value is different than what's passed.  This
-    // optimizes the actual scaling math later, allowing a fast 8x8-bit
-    // multiply and taking the MSB.  'brightness' is a uint8_t, adding 1
-    // here may (intentionally) roll over...so 0 = max brightness (color
-    // values are interpreted literally; no scaling), 1 = min brightness
-    // (off), 255 = just below max brightness.
-    brightness = b + 1;
+    // 255 = full brightness (color values are sent as they are), 0 = off.
+    // The scaling itself is TinyPICOColor::Scale8, in DotStar_Show.
+    brightness = b;
 }
 
 // Convert separate R,G,B to packed value
 uint32_t TinyPICO::Color(uint8_t r, uint8_t g, uint8_t b)
 {
-    return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+    return TinyPICOColor::Pack(r, g, b);
 }
 
 void TinyPICO::DotStar_Show(void)
@@ -77,7 +80,11 @@ void TinyPICO::DotStar_Show(void)
         delay(10);
     }
     
-    uint16_t b16 = (uint16_t)brightness; // Type-convert for fixed-point math
+    uint32_t startCycles = TinyPICOProfiler::GetCycles();
+
+    // Scale pixel brightness on output, leaving the stored colour alone
+    uint8_t out[3];
+    TinyPICOColor::ScaleBuffer(out, pixel, 3, brightness);
 
     // Start-frame marker
     for( int i=0; i<4; i++) swspi_out(0x00);    
@@ -86,15 +93,13 @@ void TinyPICO::DotStar_Show(void)
     swspi_out(0xFF);     
     
     for( int i=0; i<3; i++)
-    {
-        if( brightness > 0)
-            swspi_out((pixel[i] * b16) >> 8); // Scale, write - Scaling pixel brightness on output
-        else
-            swspi_out(pixel[i]); // R,G,B @Full brightness (no scaling) 
-    }             
+        swspi_out(out[i]);
 
     // // End frame marker
     swspi_out(0xFF);  
+
+    if ( profiler != NULL )
+        profiler->RecordCycles( profilerMarker, TinyPICOProfiler::GetCycles() - startCycles );
 }
 
 
@@ -171,22 +176,7 @@ void TinyPICO::DotStar_CycleColor( unsigned long wait = 0 )
         nextRotation = millis();
 
         colorRotation++;
-        byte WheelPos = 255 - colorRotation;
-        if(WheelPos < 85)
-        {
-            DotStar_SetPixelColor(255 - WheelPos * 3, 0, WheelPos * 3);
-        }
-        else if(WheelPos < 170)
-        {
-            WheelPos -= 85;
-            DotStar_SetPixelColor(0, WheelPos * 3, 255 - WheelPos * 3);
-        }
-        else
-        {
-            WheelPos -= 170;
-            DotStar_SetPixelColor(WheelPos * 3, 255 - WheelPos * 3, 0);
-        }
-        DotStar_Show();
+        DotStar_SetPixelColor(TinyPICOColor::HSV(colorRotation, 255, 255));
     }
 }
 
@@ -209,6 +199,12 @@ float TinyPICO::GetBatteryVoltage()
     uint32_t raw, mv;
     esp_adc_cal_characteristics_t chars;
 
+#ifdef TINYPICO_ADC_ENGINE
+    // already filtered and calibrated
+    if ( adcEngine != NULL && adcEngine->IsRunning() )
+        return adcEngine->GetMilliVolts( adcChannel ) / 1000.0;
+#endif
+
     // only check voltage every 1 second
     if ( nextVoltage - millis() > 0 )
     {
@@ -229,6 +225,33 @@ float TinyPICO::GetBatteryVoltage()
     return ( lastMeasuredVoltage );
 }
 
+int TinyPICO::UseADCEngine( TinyPICOADC &adc )
+{
+#ifdef TINYPICO_ADC_ENGINE
+    // scaled back up through the battery divider
+    int channel = adc.AddChannel( BAT_VOLTAGE, ADC_ATTEN_DB_11, LOWER_DIVIDER + UPPER_DIVIDER, LOWER_DIVIDER );
+    if ( channel < 0 )
+        return -1;
+
+    adcEngine = &adc;
+    adcChannel = channel;
+    return channel;
+#else
+    return -1;
+#endif
+}
+
+int TinyPICO::UseProfiler( TinyPICOProfiler &p )
+{
+    int marker = p.AddMarker( "DotStar" );
+    if ( marker < 0 )
+        return -1;
+
+    profiler = &p;
+    profilerMarker = marker;
+    return marker;
+}
+
 // Tone - Sound wrapper
 void TinyPICO::Tone( uint8_t pin, uint32_t freq )
 {
@@ -42,6 +42,10 @@
 		#endif
 
 	#include <SPI.h>
+
+	// Only the sketches that use these need their headers
+	class TinyPICOADC;
+	class TinyPICOProfiler;
 	
 	#define DOTSTAR_PWR 13
 	#define DOTSTAR_DATA 2
@@ -59,6 +63,11 @@
 			// TinyPICO Features
 			void DotStar_SetPower( bool state );
 			float GetBatteryVoltage();
+			// Read the battery through a continuous ADC engine instead of sampling it here - call before adc.Begin()
+			// Returns the engine channel, or -1
+			int UseADCEngine( TinyPICOADC &adc );
+			// Time every DotStar_Show() into the profiler - returns the marker, or -1
+			int UseProfiler( TinyPICOProfiler &profiler );
 			bool IsChargingBattery();
 
 			// Dotstar
@@ -84,6 +93,10 @@
 		private:
 			unsigned long nextVoltage; 
 			float lastMeasuredVoltage;
+			TinyPICOADC *adcEngine;
+			int adcChannel;
+			TinyPICOProfiler *profiler;
+			int profilerMarker;
 			byte colorRotation;
 			unsigned long nextRotation;
 			uint8_t brightness;                             // Global brightness setting  
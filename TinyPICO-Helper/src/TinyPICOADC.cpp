@@ -0,0 +1,212 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - Continuous ADC1 engine
+//
+// See "TinyPICOADC.h" for purpose and usage.
+// ---------------------------------------------------------------------------
+
+#include "TinyPICOADC.h"
+
+#ifdef TINYPICO_ADC_ENGINE
+
+#define ADC_ENGINE_DEFAULT_VREF 1100    // mV, used when the chip has no eFuse calibration
+#define ADC_ENGINE_POOL_BYTES 1024
+
+TinyPICOADC::TinyPICOADC()
+{
+    numChannels = 0;
+    shift = 8;
+    stopping = false;
+    overruns = 0;
+    task = NULL;
+
+    for ( int i = 0; i < ADC1_CHANNEL_MAX; i++ )
+        channelIndex[ i ] = -1;
+    for ( int i = 0; i < ADC_ATTEN_MAX; i++ )
+        charsValid[ i ] = false;
+}
+
+int TinyPICOADC::AddChannel( uint8_t gpio, adc_atten_t atten, uint16_t scaleMul, uint16_t scaleDiv )
+{
+    if ( task != NULL || numChannels >= ADC_ENGINE_MAX_CHANNELS || scaleDiv == 0 )
+        return -1;
+
+    // ADC1 channels are 0-7, ADC2 ones come after
+    int8_t ch = digitalPinToAnalogChannel( gpio );
+    if ( ch < 0 || ch >= ADC1_CHANNEL_MAX || channelIndex[ ch ] >= 0 )
+        return -1;
+
+    TinyPICOADCChannel &c = channels[ numChannels ];
+    memset( &c, 0, sizeof( c ) );
+    c.gpio = gpio;
+    c.channel = (adc1_channel_t)ch;
+    c.atten = atten;
+    c.scaleMul = scaleMul;
+    c.scaleDiv = scaleDiv;
+
+    channelIndex[ ch ] = numChannels;
+    return numChannels++;
+}
+
+bool TinyPICOADC::Begin( uint32_t sampleHz, uint8_t filterShift, UBaseType_t priority, BaseType_t core )
+{
+    if ( task != NULL || numChannels == 0 )
+        return false;
+
+    shift = constrain( filterShift, 0, 16 );
+
+    uint32_t mask = 0;
+    adc_digi_pattern_config_t pattern[ ADC_ENGINE_MAX_CHANNELS ];
+    for ( int i = 0; i < numChannels; i++ )
+    {
+        TinyPICOADCChannel &c = channels[ i ];
+        mask |= 1 << c.channel;
+
+        pattern[ i ].atten = c.atten;
+        pattern[ i ].channel = c.channel;
+        pattern[ i ].unit = 0;      // ADC1
+        pattern[ i ].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+
+        // characterise each attenuation once, rather than per reading
+        if ( !charsValid[ c.atten ] )
+        {
+            esp_adc_cal_characterize( ADC_UNIT_1, c.atten, ADC_WIDTH_BIT_12, ADC_ENGINE_DEFAULT_VREF, &chars[ c.atten ] );
+            charsValid[ c.atten ] = true;
+        }
+
+        // start the filter from a real reading, so values are right from the first pass
+        adc1_config_width( ADC_WIDTH_BIT_12 );
+        adc1_config_channel_atten( c.channel, c.atten );
+        int raw = adc1_get_raw( c.channel );
+        c.filter = (uint32_t)raw << shift;
+        c.raw = raw;
+        c.milliVolts = esp_adc_cal_raw_to_voltage( raw, &chars[ c.atten ] ) * c.scaleMul / c.scaleDiv;
+        c.samples = 0;
+    }
+
+    adc_digi_init_config_t init = {};
+    init.max_store_buf_size = ADC_ENGINE_POOL_BYTES;
+    init.conv_num_each_intr = ADC_ENGINE_READ_BYTES;
+    init.adc1_chan_mask = mask;
+    init.adc2_chan_mask = 0;
+    if ( adc_digi_initialize( &init ) != ESP_OK )
+        return false;
+
+    adc_digi_configuration_t config = {};
+    config.conv_limit_en = true;    // required on the ESP32
+    config.conv_limit_num = 250;
+    config.pattern_num = numChannels;
+    config.adc_pattern = pattern;
+    config.sample_freq_hz = max( sampleHz, (uint32_t)ADC_ENGINE_MIN_RATE );
+    config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+    config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+
+    if ( adc_digi_controller_configure( &config ) != ESP_OK || adc_digi_start() != ESP_OK )
+    {
+        adc_digi_deinitialize();
+        return false;
+    }
+
+    stopping = false;
+    if ( xTaskCreatePinnedToCore( EngineTask, "ADC", 3072, this, priority, &task, core ) != pdPASS )
+    {
+        task = NULL;
+        adc_digi_stop();
+        adc_digi_deinitialize();
+        return false;
+    }
+
+    return true;
+}
+
+void TinyPICOADC::End()
+{
+    if ( task == NULL )
+        return;
+
+    // the task sees this within one read timeout and cleans up after itself
+    stopping = true;
+    while ( task != NULL )
+        delay( 1 );
+}
+
+void TinyPICOADC::EngineTask( void *arg )
+{
+    TinyPICOADC *self = (TinyPICOADC *)arg;
+    uint8_t data[ ADC_ENGINE_READ_BYTES ];
+
+    while ( !self->stopping )
+    {
+        uint32_t length = 0;
+        esp_err_t err = adc_digi_read_bytes( data, sizeof( data ), &length, 100 );
+
+        // the pool filled up and the oldest results were dropped - what we did get is still good
+        if ( err == ESP_ERR_INVALID_STATE )
+            self->overruns++;
+        else if ( err != ESP_OK )
+            continue;
+
+        self->Process( data, length );
+    }
+
+    adc_digi_stop();
+    adc_digi_deinitialize();
+
+    self->task = NULL;
+    vTaskDelete( NULL );
+}
+
+void TinyPICOADC::Process( const uint8_t *data, uint32_t length )
+{
+    uint32_t touched = 0;
+
+    for ( uint32_t i = 0; i + 1 < length; i += 2 )
+    {
+        const adc_digi_output_data_t *p = (const adc_digi_output_data_t *)&data[ i ];
+        uint8_t ch = p->type1.channel;
+        if ( ch >= ADC1_CHANNEL_MAX || channelIndex[ ch ] < 0 )
+            continue;
+
+        // filter += reading - filter / 2^shift, which keeps the filtered value at filter >> shift
+        TinyPICOADCChannel &c = channels[ channelIndex[ ch ] ];
+        c.filter += p->type1.data - ( c.filter >> shift );
+        c.samples++;
+        touched |= 1 << channelIndex[ ch ];
+    }
+
+    // calibration is one lookup per channel per pass, not per reading
+    while ( touched )
+    {
+        TinyPICOADCChannel &c = channels[ __builtin_ctz( touched ) ];
+        touched &= touched - 1;
+
+        uint16_t raw = c.filter >> shift;
+        c.raw = raw;
+        c.milliVolts = esp_adc_cal_raw_to_voltage( raw, &chars[ c.atten ] ) * c.scaleMul / c.scaleDiv;
+    }
+}
+
+uint16_t TinyPICOADC::GetRaw( int channel )
+{
+    if ( channel < 0 || channel >= numChannels )
+        return 0;
+
+    return channels[ channel ].raw;
+}
+
+uint32_t TinyPICOADC::GetMilliVolts( int channel )
+{
+    if ( channel < 0 || channel >= numChannels )
+        return 0;
+
+    return channels[ channel ].milliVolts;
+}
+
+uint32_t TinyPICOADC::GetSamples( int channel )
+{
+    if ( channel < 0 || channel >= numChannels )
+        return 0;
+
+    return channels[ channel ].samples;
+}
+
+#endif
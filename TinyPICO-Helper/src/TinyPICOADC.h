@@ -0,0 +1,84 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - Continuous ADC1 engine
+//
+// Runs ADC1 in continuous (DMA) mode across a set of channels - light sensor,
+// battery... - and keeps a filtered, calibrated value for each one. A task
+// drains the DMA results, runs each channel through an exponential filter
+// and publishes the raw value and millivolts, so GetRaw() and
+// GetMilliVolts() are just a memory read from anywhere in the sketch. The
+// calibration curve is characterised once per attenuation in Begin().
+//
+// While it is running ADC1 belongs to the engine, so don't analogRead() ADC1
+// pins (GPIO 32-39). The DMA goes through I2S0, so that isn't free either.
+// ---------------------------------------------------------------------------
+
+#ifndef TinyPICOADC_h
+	#define TinyPICOADC_h
+
+	#include <Arduino.h>
+
+	// The engine decodes the ESP32's DMA result format, so other chips (the S3 on a TinyS3...) go without.
+	// Check TINYPICO_ADC_ENGINE before using it in code shared between boards.
+	#if CONFIG_IDF_TARGET_ESP32
+		#define TINYPICO_ADC_ENGINE 1
+
+		#include <freertos/FreeRTOS.h>
+		#include <freertos/task.h>
+		#include "driver/adc.h"
+		#include "esp_adc_cal.h"
+
+		#define ADC_ENGINE_MAX_CHANNELS 8
+		#define ADC_ENGINE_READ_BYTES 256       // DMA results handled per pass, 2 bytes each
+		#define ADC_ENGINE_MIN_RATE 20000       // the ESP32 can't run the digital controller any slower
+
+		struct TinyPICOADCChannel
+		{
+			uint8_t gpio;
+			adc1_channel_t channel;
+			adc_atten_t atten;
+			uint16_t scaleMul;              // mV reported = calibrated mV * scaleMul / scaleDiv
+			uint16_t scaleDiv;              // (for a divider in front of the pin)
+
+			uint32_t filter;                // raw reading << filterShift
+			volatile uint16_t raw;          // filtered
+			volatile uint32_t milliVolts;   // filtered, calibrated and scaled
+			volatile uint32_t samples;
+		};
+
+		class TinyPICOADC
+		{
+			public:
+				TinyPICOADC();
+
+				// gpio must be an ADC1 pin - returns a channel index, or -1. Add channels before Begin().
+				int AddChannel( uint8_t gpio, adc_atten_t atten = ADC_ATTEN_DB_11, uint16_t scaleMul = 1, uint16_t scaleDiv = 1 );
+
+				// sampleHz is the total conversion rate, shared between the channels
+				// filterShift sets the filter time constant - each new reading moves the value 1/2^filterShift of the way
+				bool Begin( uint32_t sampleHz = ADC_ENGINE_MIN_RATE, uint8_t filterShift = 8, UBaseType_t priority = 1, BaseType_t core = tskNO_AFFINITY );
+				void End();
+				bool IsRunning() { return task != NULL; }
+
+				uint16_t GetRaw( int channel );
+				uint32_t GetMilliVolts( int channel );
+				uint32_t GetSamples( int channel );
+				// times the DMA pool filled up before the task got to it
+				uint32_t GetOverruns() { return overruns; }
+
+			private:
+				static void EngineTask( void *arg );
+				void Process( const uint8_t *data, uint32_t length );
+
+				TinyPICOADCChannel channels[ ADC_ENGINE_MAX_CHANNELS ];
+				int8_t channelIndex[ ADC1_CHANNEL_MAX ];    // ADC1 channel to our index
+				esp_adc_cal_characteristics_t chars[ ADC_ATTEN_MAX ];
+				bool charsValid[ ADC_ATTEN_MAX ];
+				uint8_t numChannels;
+				uint8_t shift;
+				volatile bool stopping;
+				uint32_t overruns;
+				TaskHandle_t task;
+		};
+	#endif
+
+#endif
@@ -0,0 +1,196 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - LIS3DH FIFO accelerometer service
+//
+// See "TinyPICOAccel.h" for purpose and usage.
+// ---------------------------------------------------------------------------
+
+#include "TinyPICOAccel.h"
+
+// The I2C driver buffers at most this many bytes per read, so a full FIFO takes two bursts
+#define ACCEL_MAX_BURST_SAMPLES 21
+
+static const uint16_t odrHz[] = { 0, 1, 10, 25, 50, 100, 200, 400 };
+
+TinyPICOAccel::TinyPICOAccel( TwoWire &w ) : wire( w )
+{
+    address = 0x18;
+    irqPin = -1;
+    watermark = 16;
+    samplePeriodUs = 10000;
+    overruns = 0;
+    lastSampleTime = 0;
+    irqPending = false;
+    irqTime = 0;
+    numConsumers = 0;
+}
+
+bool TinyPICOAccel::begin( uint8_t addr, int irq, accelODR_t odr, uint8_t wtm )
+{
+    address = addr;
+    irqPin = irq;
+    watermark = constrain( wtm, 1, LIS3DH_FIFO_SIZE - 1 );
+    samplePeriodUs = 1000000UL / odrHz[ odr ];
+
+    // Keep the full scale range that was already set, turn on block data update and high resolution
+    uint8_t ctrl4;
+    if ( !ReadRegisters( LIS3DH_REG_CTRL4, &ctrl4, 1 ) )
+        return false;
+    ctrl4 = ( ctrl4 & 0x30 ) | 0x80 | 0x08;
+
+    bool ok = WriteRegister( LIS3DH_REG_CTRL1, ( odr << 4 ) | 0x07 );  // data rate, normal power, XYZ on
+    ok &= WriteRegister( LIS3DH_REG_CTRL4, ctrl4 );
+
+    // Reset the FIFO by dropping through bypass mode, then stream with our watermark
+    ok &= WriteRegister( LIS3DH_REG_CTRL5, 0x40 );                      // FIFO_EN
+    ok &= WriteRegister( LIS3DH_REG_FIFO_CTRL, 0x00 );
+    ok &= WriteRegister( LIS3DH_REG_FIFO_CTRL, 0x80 | watermark );      // stream mode, FTH
+    lastSampleTime = micros();
+
+    if ( irqPin > -1 )
+    {
+        ok &= WriteRegister( LIS3DH_REG_CTRL3, 0x04 );                  // I1_WTM - watermark on INT1
+        pinMode( irqPin, INPUT );
+        attachInterruptArg( digitalPinToInterrupt( irqPin ), WatermarkISR, this, RISING );
+    }
+    else
+    {
+        ok &= WriteRegister( LIS3DH_REG_CTRL3, 0x00 );
+    }
+
+    return ok;
+}
+
+void TinyPICOAccel::end()
+{
+    if ( irqPin > -1 )
+        detachInterrupt( digitalPinToInterrupt( irqPin ) );
+
+    WriteRegister( LIS3DH_REG_CTRL3, 0x00 );
+    WriteRegister( LIS3DH_REG_FIFO_CTRL, 0x00 );
+    WriteRegister( LIS3DH_REG_CTRL5, 0x00 );
+}
+
+bool TinyPICOAccel::AddConsumer( accelBlockFn fn, void *context )
+{
+    if ( numConsumers >= ACCEL_MAX_CONSUMERS || fn == NULL )
+        return false;
+
+    consumers[ numConsumers ] = fn;
+    contexts[ numConsumers ] = context;
+    numConsumers++;
+    return true;
+}
+
+void IRAM_ATTR TinyPICOAccel::WatermarkISR( void *arg )
+{
+    TinyPICOAccel *self = (TinyPICOAccel *)arg;
+    self->irqTime = micros();
+    self->irqPending = true;
+}
+
+uint8_t TinyPICOAccel::Service()
+{
+    bool fromIrq = false;
+    uint32_t watermarkTime = 0;
+
+    if ( irqPin > -1 )
+    {
+        // INT1 stays high while the FIFO is over the watermark, so if we missed the edge
+        // (e.g. it filled before begin() attached the ISR) the level still gets us going
+        if ( !irqPending && digitalRead( irqPin ) == LOW )
+            return 0;
+        fromIrq = irqPending;
+        watermarkTime = irqTime;
+        irqPending = false;
+    }
+
+    uint8_t src;
+    if ( !ReadRegisters( LIS3DH_REG_FIFO_SRC, &src, 1 ) )
+        return 0;
+    uint32_t newest = micros();
+
+    // Polling without the watermark reached - nothing to do yet
+    if ( irqPin < 0 && !( src & 0x80 ) )
+        return 0;
+
+    // OVRN_FIFO only says the FIFO is full. Samples were lost only if more arrived since the last read
+    // than it holds, so the oldest were overwritten.
+    uint8_t count = src & 0x1F;
+    bool dropped = false;
+    if ( src & 0x40 )
+    {
+        count = LIS3DH_FIFO_SIZE;
+        dropped = ( newest - lastSampleTime ) / samplePeriodUs > LIS3DH_FIFO_SIZE;
+        if ( dropped )
+            overruns++;
+    }
+
+    if ( count == 0 )
+        return 0;
+
+    // The edge marks the sample that reached the watermark, and any after it came a period apart.
+    // Once samples have been dropped we can't tell how many, so the read time is the best there is.
+    if ( fromIrq && !dropped && count >= watermark )
+    {
+        uint32_t fromEdge = watermarkTime + ( count - watermark ) * samplePeriodUs;
+        if ( (int32_t)( fromEdge - newest ) < 0 )
+            newest = fromEdge;
+    }
+
+    // Burst read the whole block. With the FIFO enabled the LIS3DH rolls the register address back
+    // from OUT_Z_H to OUT_X_L, so consecutive samples come out of one read.
+    uint8_t done = 0;
+    while ( done < count )
+    {
+        uint8_t n = min( (uint8_t)( count - done ), (uint8_t)ACCEL_MAX_BURST_SAMPLES );
+        if ( !ReadRegisters( LIS3DH_REG_OUT_X_L | LIS3DH_AUTO_INCREMENT, (uint8_t *)&block[ done ], n * sizeof( AccelSample ) ) )
+            break;
+        done += n;
+    }
+
+    // Left justified 12 bit data, little endian on the wire and in memory
+    for ( uint8_t i = 0; i < done; i++ )
+    {
+        block[ i ].x >>= 4;
+        block[ i ].y >>= 4;
+        block[ i ].z >>= 4;
+    }
+
+    // Anything a failed burst left behind is still in the FIFO, older than what we delivered
+    lastSampleTime = newest - ( count - done ) * samplePeriodUs;
+
+    for ( uint8_t c = 0; c < numConsumers; c++ )
+        consumers[ c ]( contexts[ c ], block, done, newest, samplePeriodUs );
+
+    return done;
+}
+
+float TinyPICOAccel::GetMilliGPerDigit()
+{
+    // High resolution mode sensitivity for 2/4/8/16G
+    static const float scale[] = { 1.0, 2.0, 4.0, 12.0 };
+    uint8_t ctrl4 = 0;
+    ReadRegisters( LIS3DH_REG_CTRL4, &ctrl4, 1 );
+    return scale[ ( ctrl4 >> 4 ) & 0x03 ];
+}
+
+bool TinyPICOAccel::WriteRegister( uint8_t reg, uint8_t value )
+{
+    wire.beginTransmission( address );
+    wire.write( reg );
+    wire.write( value );
+    return wire.endTransmission() == 0;
+}
+
+bool TinyPICOAccel::ReadRegisters( uint8_t reg, uint8_t *data, uint8_t len )
+{
+    wire.beginTransmission( address );
+    wire.write( reg );
+    if ( wire.endTransmission( false ) != 0 )
+        return false;
+    if ( wire.requestFrom( address, len ) < len )
+        return false;
+    for ( uint8_t i = 0; i < len; i++ )
+        data[ i ] = wire.read();
+    return true;
+}
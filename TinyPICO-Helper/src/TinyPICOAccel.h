@@ -0,0 +1,100 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - LIS3DH FIFO accelerometer service
+//
+// Runs the LIS3DH found on the Play and Explorer shields in FIFO stream mode
+// and hands blocks of samples to consumers, instead of polling one sample at
+// a time with a full I2C transaction each. With the IMU INT pin connected the
+// FIFO watermark interrupt tells us when a block is ready, otherwise call
+// Service() often enough that the 32 entry FIFO doesn't overflow.
+//
+// Use it after the sensor has been set up (e.g. Adafruit_LIS3DH::begin and
+// setRange) - the full scale setting is kept.
+// ---------------------------------------------------------------------------
+
+#ifndef TinyPICOAccel_h
+	#define TinyPICOAccel_h
+
+	#include <Arduino.h>
+	#include <Wire.h>
+
+	// LIS3DH registers
+	#define LIS3DH_REG_CTRL1 0x20
+	#define LIS3DH_REG_CTRL3 0x22
+	#define LIS3DH_REG_CTRL4 0x23
+	#define LIS3DH_REG_CTRL5 0x24
+	#define LIS3DH_REG_OUT_X_L 0x28
+	#define LIS3DH_REG_FIFO_CTRL 0x2E
+	#define LIS3DH_REG_FIFO_SRC 0x2F
+
+	#define LIS3DH_FIFO_SIZE 32
+	#define LIS3DH_AUTO_INCREMENT 0x80
+
+	// Output data rates for CTRL_REG1
+	typedef enum
+	{
+		ACCEL_ODR_10HZ = 0x02,
+		ACCEL_ODR_25HZ = 0x03,
+		ACCEL_ODR_50HZ = 0x04,
+		ACCEL_ODR_100HZ = 0x05,
+		ACCEL_ODR_200HZ = 0x06,
+		ACCEL_ODR_400HZ = 0x07
+	} accelODR_t;
+
+	// Raw 12 bit samples, as read from the FIFO
+	struct AccelSample
+	{
+		int16_t x;
+		int16_t y;
+		int16_t z;
+	};
+
+	// newestTimeUs is when the last sample in the block was taken, each earlier sample is periodUs before it
+	typedef void (*accelBlockFn)( void *context, const AccelSample *samples, uint8_t count, uint32_t newestTimeUs, uint32_t periodUs );
+
+	#define ACCEL_MAX_CONSUMERS 4
+
+	class TinyPICOAccel
+	{
+		public:
+			TinyPICOAccel( TwoWire &wire = Wire );
+
+			// irqPin is the GPIO connected to the LIS3DH INT1 pin, or -1 to poll the FIFO status
+			// watermark is how many samples to collect before a block is delivered (1-31)
+			bool begin( uint8_t address = 0x18, int irqPin = -1, accelODR_t odr = ACCEL_ODR_100HZ, uint8_t watermark = 16 );
+			void end();
+
+			bool AddConsumer( accelBlockFn fn, void *context );
+
+			// Call from loop - reads the FIFO when it has reached the watermark and delivers the block
+			// Returns the number of samples delivered
+			uint8_t Service();
+
+			float GetMilliGPerDigit();      // scale for the current full scale range
+			uint32_t GetSamplePeriodUs() { return samplePeriodUs; }
+			// Times the FIFO filled up and samples were overwritten before Service() got to them
+			uint32_t GetOverruns() { return overruns; }
+
+		private:
+			static void IRAM_ATTR WatermarkISR( void *arg );
+			bool WriteRegister( uint8_t reg, uint8_t value );
+			bool ReadRegisters( uint8_t reg, uint8_t *data, uint8_t len );
+
+			TwoWire &wire;
+			uint8_t address;
+			int irqPin;
+			uint8_t watermark;
+			uint32_t samplePeriodUs;
+			uint32_t overruns;
+			uint32_t lastSampleTime;    // micros() of the newest sample taken out of the FIFO
+
+			volatile bool irqPending;
+			volatile uint32_t irqTime;
+
+			AccelSample block[ LIS3DH_FIFO_SIZE ];
+
+			accelBlockFn consumers[ ACCEL_MAX_CONSUMERS ];
+			void *contexts[ ACCEL_MAX_CONSUMERS ];
+			uint8_t numConsumers;
+	};
+
+#endif
@@ -0,0 +1,146 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - Parallel boot sequence
+//
+// See "TinyPICOBoot.h" for purpose and usage.
+// ---------------------------------------------------------------------------
+
+#include "TinyPICOBoot.h"
+
+static const char *stateNames[] = { "pending", "running", "ok", "FAILED", "skipped" };
+
+TinyPICOBoot::TinyPICOBoot()
+{
+    numStages = 0;
+    failedMask = 0;
+    startUs = 0;
+    totalUs = 0;
+    events = NULL;
+}
+
+int TinyPICOBoot::AddStage( const char *name, bootStageFn fn, void *context, uint32_t dependsOn, uint32_t stackSize )
+{
+    if ( numStages >= BOOT_MAX_STAGES || fn == NULL || events != NULL )
+        return -1;
+
+    // only earlier stages, which also rules out depending on a stage that failed to add (-1)
+    if ( dependsOn & ~( ( 1UL << numStages ) - 1 ) )
+        return -1;
+
+    TinyPICOBootStage &s = stages[ numStages ];
+    memset( &s, 0, sizeof( s ) );
+    s.name = name;
+    s.fn = fn;
+    s.context = context;
+    s.dependsOn = dependsOn;
+    s.stackSize = stackSize;
+    s.state = BOOT_PENDING;
+    s.owner = this;
+    s.id = numStages;
+
+    return numStages++;
+}
+
+void TinyPICOBoot::StageTask( void *arg )
+{
+    TinyPICOBootStage *s = (TinyPICOBootStage *)arg;
+    s->owner->RunStage( *s );
+    vTaskDelete( NULL );
+}
+
+void TinyPICOBoot::RunStage( TinyPICOBootStage &s )
+{
+    if ( s.dependsOn )
+        xEventGroupWaitBits( events, s.dependsOn, pdFALSE, pdTRUE, portMAX_DELAY );
+
+    s.startUs = micros() - startUs;
+
+    if ( __atomic_load_n( &failedMask, __ATOMIC_ACQUIRE ) & s.dependsOn )
+    {
+        s.state = BOOT_SKIPPED;
+    }
+    else
+    {
+        s.state = BOOT_RUNNING;
+        bool ok = s.fn( s.context );
+        s.durationUs = micros() - startUs - s.startUs;
+        s.state = ok ? BOOT_DONE : BOOT_FAILED;
+    }
+
+    // failures propagate - anything waiting on this stage sees the bit and then skips itself
+    if ( s.state != BOOT_DONE )
+        __atomic_or_fetch( &failedMask, 1UL << s.id, __ATOMIC_RELEASE );
+
+    xEventGroupSetBits( events, 1UL << s.id );
+}
+
+bool TinyPICOBoot::Run( uint32_t timeoutMs )
+{
+    if ( events != NULL || numStages == 0 )
+        return false;
+
+    events = xEventGroupCreate();
+    if ( events == NULL )
+        return false;
+
+    startUs = micros();
+    uint32_t allStages = ( 1UL << numStages ) - 1;
+
+    // Stages run at our priority, so they share the CPU with each other rather than with loop()
+    UBaseType_t priority = uxTaskPriorityGet( NULL );
+    for ( int i = 0; i < numStages; i++ )
+    {
+        TinyPICOBootStage &s = stages[ i ];
+        if ( xTaskCreatePinnedToCore( StageTask, s.name, s.stackSize, &s, priority, NULL, tskNO_AFFINITY ) != pdPASS )
+        {
+            // couldn't start it, so fail it here the same way the task would have
+            s.state = BOOT_FAILED;
+            __atomic_or_fetch( &failedMask, 1UL << i, __ATOMIC_RELEASE );
+            xEventGroupSetBits( events, 1UL << i );
+        }
+    }
+
+    EventBits_t done = xEventGroupWaitBits( events, allStages, pdFALSE, pdTRUE, pdMS_TO_TICKS( timeoutMs ) );
+    totalUs = micros() - startUs;
+
+    // On a timeout the stage tasks that are still going keep using the event group, so it stays allocated
+    if ( ( done & allStages ) != allStages )
+        return false;
+
+    vEventGroupDelete( events );
+    return failedMask == 0;
+}
+
+bool TinyPICOBoot::Succeeded( int stage )
+{
+    if ( stage < 0 || stage >= numStages )
+        return false;
+
+    return stages[ stage ].state == BOOT_DONE;
+}
+
+const TinyPICOBootStage *TinyPICOBoot::GetStage( int stage )
+{
+    if ( stage < 0 || stage >= numStages )
+        return NULL;
+
+    return &stages[ stage ];
+}
+
+uint32_t TinyPICOBoot::GetSequentialUs()
+{
+    uint32_t total = 0;
+    for ( int i = 0; i < numStages; i++ )
+        total += stages[ i ].durationUs;
+    return total;
+}
+
+void TinyPICOBoot::PrintReport( Print &out )
+{
+    out.printf( "%-10s %8s %8s %s\r\n", "Stage", "StartMs", "TookMs", "Result" );
+    for ( int i = 0; i < numStages; i++ )
+    {
+        TinyPICOBootStage &s = stages[ i ];
+        out.printf( "%-10s %8u %8u %s\r\n", s.name, s.startUs / 1000, s.durationUs / 1000, stateNames[ s.state ] );
+    }
+    out.printf( "Boot took %u ms (%u ms one after another)\r\n", totalUs / 1000, GetSequentialUs() / 1000 );
+}
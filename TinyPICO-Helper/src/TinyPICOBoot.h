@@ -0,0 +1,95 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - Parallel boot sequence
+//
+// Runs the independent parts of setup() (display, IMU, touch, SD card, boot
+// sound...) as one FreeRTOS task per stage instead of one after another.
+// Each stage waits only for the stages it depends on, so a slow init or a
+// splash screen hold doesn't hold up everything behind it. A stage that
+// fails causes the stages that depend on it to be skipped, and every stage
+// records when it started and how long it took.
+//
+// Stages that share a bus must either depend on each other or use drivers
+// that take the bus lock (Wire and SPI transactions do on arduino-esp32 2.x).
+// ---------------------------------------------------------------------------
+
+#ifndef TinyPICOBoot_h
+	#define TinyPICOBoot_h
+
+	#include <Arduino.h>
+	#include <freertos/FreeRTOS.h>
+	#include <freertos/task.h>
+	#include <freertos/event_groups.h>
+
+	// one event group bit per stage, and FreeRTOS keeps the top 8 bits for itself
+	#define BOOT_MAX_STAGES 16
+	#define BOOT_STAGE_STACK 4096
+
+	// return false if the stage failed
+	typedef bool (*bootStageFn)( void *context );
+
+	typedef enum
+	{
+		BOOT_PENDING,
+		BOOT_RUNNING,
+		BOOT_DONE,
+		BOOT_FAILED,
+		BOOT_SKIPPED,       // something it depends on failed
+	} bootStageState_t;
+
+	class TinyPICOBoot;
+
+	struct TinyPICOBootStage
+	{
+		const char *name;
+		bootStageFn fn;
+		void *context;
+		uint32_t dependsOn;     // bit mask of stage ids
+		uint32_t stackSize;
+		volatile bootStageState_t state;
+
+		// us after Run() was called
+		uint32_t startUs;
+		uint32_t durationUs;
+
+		TinyPICOBoot *owner;
+		uint8_t id;
+	};
+
+	class TinyPICOBoot
+	{
+		public:
+			TinyPICOBoot();
+
+			// returns a stage id, or -1 if the stage table is full or a dependency isn't an earlier stage
+			// (so there can't be a cycle)
+			int AddStage( const char *name, bootStageFn fn, void *context = NULL, uint32_t dependsOn = 0, uint32_t stackSize = BOOT_STAGE_STACK );
+
+			// dependency mask for AddStage - After( a ) | After( b )
+			static uint32_t After( int stage ) { return stage >= 0 ? 1UL << stage : 0; }
+
+			// Starts every stage and blocks until they have all finished or timeoutMs has passed.
+			// Returns true if every stage succeeded.
+			bool Run( uint32_t timeoutMs = 10000 );
+
+			bool Succeeded( int stage );
+			const TinyPICOBootStage *GetStage( int stage );
+
+			// wall time of the last Run(), and what the same stages would have taken one after another
+			uint32_t GetTotalUs() { return totalUs; }
+			uint32_t GetSequentialUs();
+
+			void PrintReport( Print &out );
+
+		private:
+			static void StageTask( void *arg );
+			void RunStage( TinyPICOBootStage &s );
+
+			TinyPICOBootStage stages[ BOOT_MAX_STAGES ];
+			uint8_t numStages;
+			uint32_t failedMask;
+			uint32_t startUs;
+			uint32_t totalUs;
+			EventGroupHandle_t events;
+	};
+
+#endif
@@ -0,0 +1,157 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - Integer colour maths
+//
+// Header only colour helpers shared by the DotStar and LED matrix sketches.
+// Colours are packed 0x00RRGGBB like TinyPICO::Color(), everything is 8 bit
+// fixed point, and the constexpr functions work at compile time, so
+// constant colour tables cost nothing at runtime:
+//
+//   const uint16_t colors[] = { TinyPICOColor::To565( TinyPICOColor::HSV( 0, 255, 255 ) ), ... };
+//
+// The buffer kernels work on plain byte arrays (R,G,B,R,G,B... or any other
+// order), with no branches in the loop, so the compiler can vectorise them.
+// ---------------------------------------------------------------------------
+
+#ifndef TinyPICOColor_h
+	#define TinyPICOColor_h
+
+	#include <stdint.h>
+	#include <stddef.h>
+
+	namespace TinyPICOColor
+	{
+		constexpr uint32_t Pack( uint8_t r, uint8_t g, uint8_t b ) { return ( (uint32_t)r << 16 ) | ( (uint32_t)g << 8 ) | b; }
+		constexpr uint8_t Red( uint32_t c ) { return (uint8_t)( c >> 16 ); }
+		constexpr uint8_t Green( uint32_t c ) { return (uint8_t)( c >> 8 ); }
+		constexpr uint8_t Blue( uint32_t c ) { return (uint8_t)c; }
+
+		// 16 bit 5-6-5, for Adafruit_GFX displays and matrices
+		constexpr uint16_t To565( uint32_t c ) { return ( ( Red( c ) & 0xF8 ) << 8 ) | ( ( Green( c ) & 0xFC ) << 3 ) | ( Blue( c ) >> 3 ); }
+
+		// v * scale / 256, with 255 leaving v unchanged
+		constexpr uint8_t Scale8( uint8_t v, uint8_t scale ) { return ( (uint16_t)v * ( scale + 1 ) ) >> 8; }
+
+		// amount 0 is all a, 255 is all b - the weight is stretched to 0-256 so both ends are exact
+		constexpr uint16_t BlendWeight( uint8_t amount ) { return amount + ( amount >> 7 ); }
+
+		constexpr uint8_t Blend8( uint8_t a, uint8_t b, uint8_t amount )
+		{
+			return ( (uint16_t)a * ( 256 - BlendWeight( amount ) ) + (uint16_t)b * BlendWeight( amount ) ) >> 8;
+		}
+
+		constexpr uint32_t Scale( uint32_t c, uint8_t scale )
+		{
+			return Pack( Scale8( Red( c ), scale ), Scale8( Green( c ), scale ), Scale8( Blue( c ), scale ) );
+		}
+
+		constexpr uint32_t Blend( uint32_t a, uint32_t b, uint8_t amount )
+		{
+			return Pack( Blend8( Red( a ), Red( b ), amount ), Blend8( Green( a ), Green( b ), amount ), Blend8( Blue( a ), Blue( b ), amount ) );
+		}
+
+		// Gamma 2.8, so brightness steps look even to the eye
+		static constexpr uint8_t Gamma8[ 256 ] =
+		{
+			  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+			  0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,   1,   1,   1,
+			  1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+			  2,   3,   3,   3,   3,   3,   3,   3,   4,   4,   4,   4,   4,   5,   5,   5,
+			  5,   6,   6,   6,   6,   7,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,
+			 10,  10,  11,  11,  11,  12,  12,  13,  13,  13,  14,  14,  15,  15,  16,  16,
+			 17,  17,  18,  18,  19,  19,  20,  20,  21,  21,  22,  22,  23,  24,  24,  25,
+			 25,  26,  27,  27,  28,  29,  29,  30,  31,  32,  32,  33,  34,  35,  35,  36,
+			 37,  38,  39,  39,  40,  41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  50,
+			 51,  52,  54,  55,  56,  57,  58,  59,  60,  61,  62,  63,  64,  66,  67,  68,
+			 69,  70,  72,  73,  74,  75,  77,  78,  79,  81,  82,  83,  85,  86,  87,  89,
+			 90,  92,  93,  95,  96,  98,  99, 101, 102, 104, 105, 107, 109, 110, 112, 114,
+			115, 117, 119, 120, 122, 124, 126, 127, 129, 131, 133, 135, 137, 138, 140, 142,
+			144, 146, 148, 150, 152, 154, 156, 158, 160, 162, 164, 167, 169, 171, 173, 175,
+			177, 180, 182, 184, 186, 189, 191, 193, 196, 198, 200, 203, 205, 208, 210, 213,
+			215, 218, 220, 223, 225, 228, 231, 233, 236, 239, 241, 244, 247, 249, 252, 255,
+		};
+
+		constexpr uint32_t Gamma( uint32_t c ) { return Pack( Gamma8[ Red( c ) ], Gamma8[ Green( c ) ], Gamma8[ Blue( c ) ] ); }
+
+		// HSV with hue 0-255 around the whole wheel (0 red, 85 green, 170 blue), in six sectors
+		constexpr uint32_t HSVSector( uint8_t sector, uint8_t v, uint8_t p, uint8_t q, uint8_t t )
+		{
+			return sector == 0 ? Pack( v, t, p ) :
+			       sector == 1 ? Pack( q, v, p ) :
+			       sector == 2 ? Pack( p, v, t ) :
+			       sector == 3 ? Pack( p, q, v ) :
+			       sector == 4 ? Pack( t, p, v ) :
+			                     Pack( v, p, q );
+		}
+
+		constexpr uint32_t HSVFraction( uint16_t h6, uint8_t s, uint8_t v )
+		{
+			return HSVSector( h6 >> 8, v,
+			                  Scale8( v, 255 - s ),
+			                  Scale8( v, 255 - Scale8( s, h6 & 0xFF ) ),
+			                  Scale8( v, 255 - Scale8( s, 255 - ( h6 & 0xFF ) ) ) );
+		}
+
+		constexpr uint32_t HSV( uint8_t h, uint8_t s, uint8_t v ) { return HSVFraction( (uint16_t)h * 6, s, v ); }
+
+		// Palettes are 16 colours, and a 0-255 index blends smoothly between neighbouring entries
+		// (wrapping from the last back to the first)
+		#define COLOR_PALETTE_SIZE 16
+
+		inline uint32_t PaletteColor( const uint32_t *palette, uint8_t index )
+		{
+			uint8_t entry = index >> 4;
+			uint8_t frac = ( index & 0x0F ) << 4;
+			return Blend( palette[ entry ], palette[ ( entry + 1 ) & ( COLOR_PALETTE_SIZE - 1 ) ], frac );
+		}
+
+		static constexpr uint32_t RainbowPalette[ COLOR_PALETTE_SIZE ] =
+		{
+			HSV( 0, 255, 255 ), HSV( 16, 255, 255 ), HSV( 32, 255, 255 ), HSV( 48, 255, 255 ),
+			HSV( 64, 255, 255 ), HSV( 80, 255, 255 ), HSV( 96, 255, 255 ), HSV( 112, 255, 255 ),
+			HSV( 128, 255, 255 ), HSV( 144, 255, 255 ), HSV( 160, 255, 255 ), HSV( 176, 255, 255 ),
+			HSV( 192, 255, 255 ), HSV( 208, 255, 255 ), HSV( 224, 255, 255 ), HSV( 240, 255, 255 ),
+		};
+
+		static constexpr uint32_t HeatPalette[ COLOR_PALETTE_SIZE ] =
+		{
+			0x000000, 0x330000, 0x660000, 0x990000, 0xCC0000, 0xFF0000, 0xFF3300, 0xFF6600,
+			0xFF9900, 0xFFCC00, 0xFFFF00, 0xFFFF33, 0xFFFF66, 0xFFFF99, 0xFFFFCC, 0xFFFFFF,
+		};
+
+		// Whole buffer kernels - n is the number of bytes, dst may be the same buffer as a source
+
+		inline void ScaleBuffer( uint8_t *dst, const uint8_t *src, size_t n, uint8_t scale )
+		{
+			uint16_t s = scale + 1;
+			for ( size_t i = 0; i < n; i++ )
+				dst[ i ] = ( src[ i ] * s ) >> 8;
+		}
+
+		inline void BlendBuffer( uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t n, uint8_t amount )
+		{
+			uint16_t wb = BlendWeight( amount );
+			uint16_t wa = 256 - wb;
+			for ( size_t i = 0; i < n; i++ )
+				dst[ i ] = ( a[ i ] * wa + b[ i ] * wb ) >> 8;
+		}
+
+		inline void GammaBuffer( uint8_t *dst, const uint8_t *src, size_t n )
+		{
+			for ( size_t i = 0; i < n; i++ )
+				dst[ i ] = Gamma8[ src[ i ] ];
+		}
+
+		// fills count RGB pixels (3 bytes each) across the palette, starting at index and stepping by step
+		inline void FillPalette( uint8_t *rgb, size_t count, const uint32_t *palette, uint8_t index, uint8_t step )
+		{
+			for ( size_t i = 0; i < count; i++, index += step )
+			{
+				uint32_t c = PaletteColor( palette, index );
+				rgb[ i * 3 ] = Red( c );
+				rgb[ i * 3 + 1 ] = Green( c );
+				rgb[ i * 3 + 2 ] = Blue( c );
+			}
+		}
+	}
+
+#endif
@@ -0,0 +1,104 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - I/O task on its own core
+//
+// See "TinyPICOIOCore.h" for purpose and usage.
+// ---------------------------------------------------------------------------
+
+#include "TinyPICOIOCore.h"
+
+TinyPICOIOCore::TinyPICOIOCore()
+{
+    scheduler = NULL;
+    pollFn = NULL;
+    pollContext = NULL;
+    pollUs = 5000;
+    stopping = false;
+    task = NULL;
+    passes = 0;
+    passMaxUs = 0;
+}
+
+void TinyPICOIOCore::SetPoll( ioCorePollFn fn, void *context, uint32_t pollMs )
+{
+    if ( task != NULL )
+        return;
+
+    pollFn = fn;
+    pollContext = context;
+    pollUs = max( pollMs, (uint32_t)1 ) * 1000;
+}
+
+bool TinyPICOIOCore::Begin( TinyPICOScheduler &s, BaseType_t core, UBaseType_t priority, uint32_t stackSize )
+{
+    if ( task != NULL )
+        return false;
+
+    scheduler = &s;
+    stopping = false;
+    if ( xTaskCreatePinnedToCore( IOTask, "IO", stackSize, this, priority, &task, core ) != pdPASS )
+    {
+        task = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+void TinyPICOIOCore::End()
+{
+    if ( task == NULL )
+        return;
+
+    // the task sees this after its current pass and deletes itself
+    stopping = true;
+    while ( task != NULL )
+        delay( 1 );
+}
+
+void TinyPICOIOCore::IOTask( void *arg )
+{
+    TinyPICOIOCore *self = (TinyPICOIOCore *)arg;
+    self->Run();
+
+    self->task = NULL;
+    vTaskDelete( NULL );
+}
+
+void TinyPICOIOCore::Run()
+{
+    uint32_t nextPoll = micros();
+
+    while ( !stopping )
+    {
+        uint32_t start = micros();
+
+        if ( pollFn != NULL && (int32_t)( start - nextPoll ) >= 0 )
+        {
+            pollFn( pollContext );
+
+            // stay on the grid, unless we've fallen a whole period behind
+            nextPoll += pollUs;
+            if ( (int32_t)( start - nextPoll ) >= 0 )
+                nextPoll = start + pollUs;
+        }
+
+        scheduler->Tick();
+
+        uint32_t took = micros() - start;
+        passes++;
+        if ( took > passMaxUs )
+            passMaxUs = took;
+
+        // Sleep until the next poll or job. Always block for at least a tick, so the core 0 idle task
+        // gets to run and the task watchdog stays fed.
+        uint32_t wait = scheduler->GetTimeToNextJob();
+        if ( pollFn != NULL )
+        {
+            int32_t untilPoll = (int32_t)( nextPoll - micros() );
+            wait = min( wait, (uint32_t)max( untilPoll, (int32_t)0 ) );
+        }
+
+        TickType_t ticks = pdMS_TO_TICKS( wait / 1000 );
+        vTaskDelay( ticks > 0 ? ticks : 1 );
+    }
+}
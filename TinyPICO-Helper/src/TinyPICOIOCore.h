@@ -0,0 +1,68 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - I/O task on its own core
+//
+// Splits a sketch in two: input and sensor acquisition (button ticks, IMU,
+// ADC, expander reads - a TinyPICOScheduler's jobs) run in a task pinned to
+// core 0, while loop() carries on with rendering and application logic on
+// core 1. A slow display.display() then no longer holds up the buttons or
+// the sensors, and the other way round.
+//
+// The I/O side publishes what it has read into a TinyPICOSnapshot and
+// loop() reads the latest one, so the two cores never wait on each other.
+// Once Begin() has been called the scheduler and the poll function belong
+// to the I/O task - don't Tick() or change jobs from loop().
+//
+// Drivers shared between the two sides must be safe to call from both.
+// Wire and SPI take a bus lock on arduino-esp32 2.x, so a display and a
+// sensor on the same bus are fine, but the sensor read waits while a
+// display transfer is going.
+// ---------------------------------------------------------------------------
+
+#ifndef TinyPICOIOCore_h
+	#define TinyPICOIOCore_h
+
+	#include <Arduino.h>
+	#include <freertos/FreeRTOS.h>
+	#include <freertos/task.h>
+	#include "TinyPICOScheduler.h"
+
+	#define IOCORE_STACK 4096
+
+	typedef void (*ioCorePollFn)( void *context );
+
+	class TinyPICOIOCore
+	{
+		public:
+			TinyPICOIOCore();
+
+			// fn runs every pollMs, before the scheduler jobs - for things that need ticking often, like buttons
+			void SetPoll( ioCorePollFn fn, void *context = NULL, uint32_t pollMs = 5 );
+
+			// Starts the task. Core 0 is the one arduino-esp32 leaves free of loop(); WiFi runs there too,
+			// at a higher priority, so keep priority low and the jobs short.
+			bool Begin( TinyPICOScheduler &scheduler, BaseType_t core = 0, UBaseType_t priority = 2, uint32_t stackSize = IOCORE_STACK );
+			void End();
+			bool IsRunning() { return task != NULL; }
+
+			// passes through the task loop, and the longest one in us
+			uint32_t GetPasses() { return passes; }
+			uint32_t GetPassMaxUs() { return passMaxUs; }
+			void ResetStats() { passes = 0; passMaxUs = 0; }
+
+		private:
+			static void IOTask( void *arg );
+			void Run();
+
+			TinyPICOScheduler *scheduler;
+			ioCorePollFn pollFn;
+			void *pollContext;
+			uint32_t pollUs;
+
+			volatile bool stopping;
+			TaskHandle_t task;
+
+			uint32_t passes;
+			uint32_t passMaxUs;
+	};
+
+#endif
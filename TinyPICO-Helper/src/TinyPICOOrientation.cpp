@@ -0,0 +1,177 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - Fixed point orientation
+//
+// See "TinyPICOOrientation.h" for purpose and usage.
+// ---------------------------------------------------------------------------
+
+#include "TinyPICOOrientation.h"
+
+// atan(z) for z in [0, 1] (Q15) in centidegrees
+// atan(z) ~= pi/4 z + z (1 - z)(0.2447 + 0.0663 z), max error ~0.11 degrees
+static inline uint32_t AtanUnit( uint32_t z )
+{
+    uint32_t linear = ( 4500 * z ) >> 15;
+    uint32_t a = ( 1402UL << 15 ) + 380 * z;        // 0.2447 and 0.0663 in centidegrees per radian, Q15
+    uint32_t b = ( z * ( 32768 - z ) ) >> 15;      // z (1 - z), Q15
+    return linear + ( ( ( a >> 7 ) * b ) >> 23 );
+}
+
+int16_t FixedAtan2( int32_t y, int32_t x )
+{
+    if ( x == 0 && y == 0 )
+        return 0;
+
+    uint32_t ax = x < 0 ? -x : x;
+    uint32_t ay = y < 0 ? -y : y;
+
+    // Keep the ratio division in 32 bits
+    while ( ( ax | ay ) >= ( 1UL << 16 ) )
+    {
+        ax >>= 1;
+        ay >>= 1;
+    }
+
+    // Fold into the first octant, so the ratio is always <= 1
+    int32_t angle;
+    if ( ax >= ay )
+        angle = AtanUnit( ( ay << 15 ) / ax );
+    else
+        angle = 9000 - AtanUnit( ( ax << 15 ) / ay );
+
+    if ( x < 0 )
+        angle = 18000 - angle;
+    if ( y < 0 )
+        angle = -angle;
+
+    return angle;
+}
+
+uint32_t FixedSqrt( uint32_t x )
+{
+    // Bit by bit, no divides
+    uint32_t result = 0;
+    uint32_t bit = 1UL << 30;
+
+    while ( bit > x )
+        bit >>= 2;
+
+    while ( bit )
+    {
+        if ( x >= result + bit )
+        {
+            x -= result + bit;
+            result = ( result >> 1 ) + bit;
+        }
+        else
+        {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return result;
+}
+
+uint32_t FixedInvSqrt( uint32_t x )
+{
+    if ( x == 0 )
+        return 0xFFFFFFFF;
+
+    // Normalise x = m * 4^k with m in [0.25, 1) as Q30, then 1/sqrt(x) = 1/sqrt(m) / 2^k
+    int k = 0;
+    uint64_t m = x;
+    while ( m >= ( 1ULL << 30 ) )
+    {
+        m >>= 2;
+        k++;
+    }
+    while ( m < ( 1ULL << 28 ) )
+    {
+        m <<= 2;
+        k--;
+    }
+    k += 15;
+
+    // Linear seed for 1/sqrt(m) in Q28 (7/3 - 4/3 m, exact at both ends), then Newton: y = y (3 - m y^2) / 2
+    int64_t y = ( ( 7LL << 28 ) - (int64_t)m ) / 3;
+    for ( int i = 0; i < 3; i++ )
+    {
+        int64_t y2 = ( y * y ) >> 28;
+        int64_t t = ( 3LL << 28 ) - ( ( (int64_t)m * y2 ) >> 30 );
+        y = ( y * t ) >> 29;
+    }
+
+    // Q28 -> Q16.16 and undo the normalisation
+    int shift = 12 + k;
+    return shift >= 0 ? (uint32_t)( y >> shift ) : (uint32_t)( y << -shift );
+}
+
+void FixedRollPitch( int32_t x, int32_t y, int32_t z, int16_t *roll, int16_t *pitch )
+{
+    if ( roll )
+        *roll = FixedAtan2( y, z );
+    if ( pitch )
+        *pitch = FixedAtan2( -x, FixedSqrt( y * y + z * z ) );
+}
+
+void FixedRollPitchBlock( const AccelSample *samples, uint8_t count, int16_t *roll, int16_t *pitch )
+{
+    for ( uint8_t i = 0; i < count; i++ )
+        FixedRollPitch( samples[ i ].x, samples[ i ].y, samples[ i ].z, roll ? &roll[ i ] : NULL, pitch ? &pitch[ i ] : NULL );
+}
+
+TinyPICOOrientation::TinyPICOOrientation( uint8_t a )
+{
+    alpha = a;
+    Reset();
+}
+
+void TinyPICOOrientation::Reset()
+{
+    primed = false;
+    roll = 0;
+    pitch = 0;
+}
+
+int16_t TinyPICOOrientation::Blend( int16_t previous, int16_t measured, int32_t rate, uint32_t dtUs )
+{
+    int32_t predicted = previous + (int32_t)( ( (int64_t)rate * dtUs ) / 1000000 );
+
+    // Blend along the short way round, so +179 and -179 average to 180 and not 0
+    int32_t diff = measured - predicted;
+    if ( diff > 18000 )
+        diff -= 36000;
+    else if ( diff < -18000 )
+        diff += 36000;
+
+    int32_t angle = predicted + ( diff * ( 256 - alpha ) ) / 256;
+    if ( angle > 18000 )
+        angle -= 36000;
+    else if ( angle < -18000 )
+        angle += 36000;
+
+    return angle;
+}
+
+void TinyPICOOrientation::Update( int32_t x, int32_t y, int32_t z, int32_t rollRate, int32_t pitchRate, uint32_t dtUs )
+{
+    int16_t r, p;
+    FixedRollPitch( x, y, z, &r, &p );
+
+    if ( !primed )
+    {
+        roll = r;
+        pitch = p;
+        primed = true;
+        return;
+    }
+
+    roll = Blend( roll, r, rollRate, dtUs );
+    pitch = Blend( pitch, p, pitchRate, dtUs );
+}
+
+void TinyPICOOrientation::Update( const AccelSample *samples, uint8_t count )
+{
+    for ( uint8_t i = 0; i < count; i++ )
+        Update( samples[ i ].x, samples[ i ].y, samples[ i ].z );
+}
@@ -0,0 +1,59 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - Fixed point orientation
+//
+// Roll and pitch from accelerometer samples using integer only maths, so it
+// can keep up with the LIS3DH FIFO rate. The ESP32 has no double precision
+// FPU, so atan2()/sqrt() on doubles are software emulated and cost several
+// microseconds each.
+//
+// Angles are in centidegrees (-18000 to 18000). FixedAtan2 is within 0.11
+// degrees of atan2().
+// ---------------------------------------------------------------------------
+
+#ifndef TinyPICOOrientation_h
+	#define TinyPICOOrientation_h
+
+	#include <stdint.h>
+	#include <stddef.h>
+	#include "TinyPICOAccel.h"
+
+	// Kernels
+	int16_t FixedAtan2( int32_t y, int32_t x );        // centidegrees
+	uint32_t FixedSqrt( uint32_t x );                 // floor(sqrt(x))
+	uint32_t FixedInvSqrt( uint32_t x );              // 1/sqrt(x) as Q16.16, x >= 1
+
+	// Roll and pitch of a single sample, in centidegrees
+	void FixedRollPitch( int32_t x, int32_t y, int32_t z, int16_t *roll, int16_t *pitch );
+
+	// Roll and pitch for each sample of a FIFO block - either output may be NULL
+	void FixedRollPitchBlock( const AccelSample *samples, uint8_t count, int16_t *roll, int16_t *pitch );
+
+	// Complementary filter
+	// Blends a fast but drifting angle (integrated gyro rate, if you have one) with the slow but
+	// noisy accelerometer angle. Without a gyro rate it acts as a simple low pass on the accel angle.
+	// alpha is the weight given to the previous angle, out of 256.
+	class TinyPICOOrientation
+	{
+		public:
+			TinyPICOOrientation( uint8_t alpha = 230 );
+
+			void Reset();
+			void SetAlpha( uint8_t a ) { alpha = a; }
+
+			// gyro rates are in centidegrees per second, dtUs is the time since the last update
+			void Update( int32_t x, int32_t y, int32_t z, int32_t rollRate = 0, int32_t pitchRate = 0, uint32_t dtUs = 0 );
+			void Update( const AccelSample *samples, uint8_t count );
+
+			int16_t GetRoll() { return roll; }
+			int16_t GetPitch() { return pitch; }
+
+		private:
+			int16_t Blend( int16_t previous, int16_t measured, int32_t rate, uint32_t dtUs );
+
+			uint8_t alpha;
+			bool primed;
+			int16_t roll;
+			int16_t pitch;
+	};
+
+#endif
@@ -0,0 +1,151 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - Loop and subsystem timing profiler
+//
+// See "TinyPICOProfiler.h" for purpose and usage.
+// ---------------------------------------------------------------------------
+
+#include "TinyPICOProfiler.h"
+
+TinyPICOProfiler::TinyPICOProfiler()
+{
+    numMarkers = 0;
+    cyclesPerUs = 240;
+    lastReport = 0;
+}
+
+int TinyPICOProfiler::AddMarker( const char *name )
+{
+    if ( numMarkers >= PROFILER_MAX_MARKERS )
+        return -1;
+
+    TinyPICOMarker &m = markers[ numMarkers ];
+    memset( &m, 0, sizeof( m ) );
+    m.name = name;
+    m.minUs = 0xFFFFFFFF;
+
+    // the CPU clock is set up by the time anyone adds a marker, Reset() picks up any later change
+    uint32_t mhz = getCpuFrequencyMhz();
+    if ( mhz > 0 )
+        cyclesPerUs = mhz;
+
+    return numMarkers++;
+}
+
+// 0-7 get a bucket each, then each doubling is split into 4
+uint8_t TinyPICOProfiler::Bucket( uint32_t us )
+{
+    if ( us < 8 )
+        return us;
+
+    uint8_t octave = 31 - __builtin_clz( us );
+    uint8_t bucket = 4 * ( octave - 1 ) + ( ( us >> ( octave - 2 ) ) & 3 );
+    return bucket < PROFILER_BUCKETS ? bucket : PROFILER_BUCKETS - 1;
+}
+
+// the largest value that lands in bucket
+uint32_t TinyPICOProfiler::BucketLimit( uint8_t bucket )
+{
+    if ( bucket < 8 )
+        return bucket;
+
+    uint8_t octave = bucket / 4 + 1;
+    uint32_t step = 1UL << ( octave - 2 );
+    return ( 4 + bucket % 4 ) * step + step - 1;
+}
+
+void TinyPICOProfiler::RecordUs( int marker, uint32_t us )
+{
+    if ( marker < 0 || marker >= numMarkers )
+        return;
+
+    TinyPICOMarker &m = markers[ marker ];
+    m.count++;
+    m.totalUs += us;
+    if ( us < m.minUs )
+        m.minUs = us;
+    if ( us > m.maxUs )
+        m.maxUs = us;
+    m.buckets[ Bucket( us ) ]++;
+}
+
+void TinyPICOProfiler::Mark( int marker )
+{
+    if ( marker < 0 || marker >= numMarkers )
+        return;
+
+    uint32_t now = GetCycles();
+    TinyPICOMarker &m = markers[ marker ];
+    if ( m.lastCycles != 0 )
+        RecordCycles( marker, now - m.lastCycles );
+    m.lastCycles = now;
+}
+
+bool TinyPICOProfiler::GetStats( int marker, TinyPICOProfileStats &stats )
+{
+    if ( marker < 0 || marker >= numMarkers )
+        return false;
+
+    TinyPICOMarker &m = markers[ marker ];
+    memset( &stats, 0, sizeof( stats ) );
+    stats.count = m.count;
+    if ( m.count == 0 )
+        return true;
+
+    stats.minUs = m.minUs;
+    stats.maxUs = m.maxUs;
+    stats.avgUs = m.totalUs / m.count;
+
+    // walk the buckets until 99% of the samples are behind us
+    uint32_t target = m.count - m.count / 100;
+    uint32_t seen = 0;
+    for ( int b = 0; b < PROFILER_BUCKETS; b++ )
+    {
+        seen += m.buckets[ b ];
+        if ( seen >= target )
+        {
+            stats.p99Us = min( BucketLimit( b ), m.maxUs );
+            break;
+        }
+    }
+
+    return true;
+}
+
+void TinyPICOProfiler::Reset()
+{
+    // the CPU clock can be changed at runtime, so pick it up again here
+    uint32_t mhz = getCpuFrequencyMhz();
+    if ( mhz > 0 )
+        cyclesPerUs = mhz;
+
+    for ( int i = 0; i < numMarkers; i++ )
+    {
+        TinyPICOMarker &m = markers[ i ];
+        m.count = 0;
+        m.totalUs = 0;
+        m.minUs = 0xFFFFFFFF;
+        m.maxUs = 0;
+        memset( m.buckets, 0, sizeof( m.buckets ) );
+    }
+}
+
+void TinyPICOProfiler::PrintReport( Print &out )
+{
+    out.printf( "%-10s %8s %8s %8s %8s %8s\r\n", "Marker", "Count", "MinUs", "AvgUs", "P99Us", "MaxUs" );
+    for ( int i = 0; i < numMarkers; i++ )
+    {
+        TinyPICOProfileStats s;
+        GetStats( i, s );
+        out.printf( "%-10s %8u %8u %8u %8u %8u\r\n", markers[ i ].name, s.count, s.minUs, s.avgUs, s.p99Us, s.maxUs );
+    }
+}
+
+void TinyPICOProfiler::Report( Print &out, uint32_t periodMs )
+{
+    if ( millis() - lastReport < periodMs )
+        return;
+
+    lastReport = millis();
+    PrintReport( out );
+    Reset();
+}
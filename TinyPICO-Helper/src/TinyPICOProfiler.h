@@ -0,0 +1,114 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - Loop and subsystem timing profiler
+//
+// Times named markers - a loop() pass, button ticks, sensor reads, display
+// flushes, DotStar shows... - from the CPU cycle counter and keeps a
+// histogram of each one in fixed memory, so the report can give min, avg,
+// p99 and max without storing samples. Recording is a cycle counter read,
+// a subtraction and a bucket increment, so it can stay in release builds.
+//
+//   int markerDisplay = profiler.AddMarker( "Display" );
+//   ...
+//   {
+//       PROFILE_SCOPE( profiler, markerDisplay );
+//       display.display();
+//   }
+//
+// Mark() times the gap between calls instead, for the loop() period. Call
+// Report() every loop to print and reset the stats every so often.
+//
+// The cycle counter is per core, so a scope must start and end on the same
+// core - loop() and tasks pinned with xTaskCreatePinnedToCore() always do.
+// Each marker should only be recorded from one task. Reports read the stats
+// without stopping anyone, so a figure can be a sample out.
+//
+// Define TINYPICO_PROFILER_DISABLED to compile the scopes and marks out.
+// ---------------------------------------------------------------------------
+
+#ifndef TinyPICOProfiler_h
+	#define TinyPICOProfiler_h
+
+	#include <Arduino.h>
+
+	#define PROFILER_MAX_MARKERS 12
+
+	// 0-7us exactly, then 4 buckets per doubling (within 19%), up to 16s
+	#define PROFILER_BUCKETS 96
+
+	struct TinyPICOProfileStats
+	{
+		uint32_t count;
+		uint32_t minUs;
+		uint32_t avgUs;
+		uint32_t p99Us;         // upper edge of the bucket the 99th percentile falls in
+		uint32_t maxUs;
+	};
+
+	struct TinyPICOMarker
+	{
+		const char *name;
+		uint32_t count;
+		uint32_t minUs;
+		uint32_t maxUs;
+		uint64_t totalUs;
+		uint32_t lastCycles;    // for Mark()
+		uint32_t buckets[ PROFILER_BUCKETS ];
+	};
+
+	class TinyPICOProfiler
+	{
+		public:
+			TinyPICOProfiler();
+
+			// returns a marker id, or -1 if the marker table is full
+			int AddMarker( const char *name );
+
+			// start with GetCycles(), then hand over the difference
+			static uint32_t GetCycles() { return ESP.getCycleCount(); }
+			void RecordCycles( int marker, uint32_t cycles ) { RecordUs( marker, cycles / cyclesPerUs ); }
+			void RecordUs( int marker, uint32_t us );
+
+			// records the time since the last Mark() of this marker (nothing the first time)
+			void Mark( int marker );
+
+			bool GetStats( int marker, TinyPICOProfileStats &stats );
+			void Reset();
+
+			void PrintReport( Print &out );
+			// prints and resets once every periodMs - call every loop
+			void Report( Print &out, uint32_t periodMs );
+
+		private:
+			static uint8_t Bucket( uint32_t us );
+			static uint32_t BucketLimit( uint8_t bucket );
+
+			TinyPICOMarker markers[ PROFILER_MAX_MARKERS ];
+			uint8_t numMarkers;
+			uint32_t cyclesPerUs;
+			uint32_t lastReport;
+	};
+
+	// times the rest of the enclosing block
+	class TinyPICOProfileScope
+	{
+		public:
+			TinyPICOProfileScope( TinyPICOProfiler &p, int m ) : profiler( p ), marker( m ), start( TinyPICOProfiler::GetCycles() ) {}
+			~TinyPICOProfileScope() { profiler.RecordCycles( marker, TinyPICOProfiler::GetCycles() - start ); }
+
+		private:
+			TinyPICOProfiler &profiler;
+			int marker;
+			uint32_t start;
+	};
+
+	#ifdef TINYPICO_PROFILER_DISABLED
+		#define PROFILE_SCOPE( profiler, marker )
+		#define PROFILE_MARK( profiler, marker )
+	#else
+		#define PROFILE_SCOPE_NAME( line ) profileScope##line
+		#define PROFILE_SCOPE_LINE( profiler, marker, line ) TinyPICOProfileScope PROFILE_SCOPE_NAME( line )( profiler, marker )
+		#define PROFILE_SCOPE( profiler, marker ) PROFILE_SCOPE_LINE( profiler, marker, __LINE__ )
+		#define PROFILE_MARK( profiler, marker ) ( profiler ).Mark( marker )
+	#endif
+
+#endif
@@ -0,0 +1,195 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - Cooperative sensor scheduler
+//
+// See "TinyPICOScheduler.h" for purpose and usage.
+// ---------------------------------------------------------------------------
+
+#include "TinyPICOScheduler.h"
+
+// Stagger the first release of each job by this much so jobs added together don't all fire together
+#define SCHEDULER_PHASE_STEP_US 7000
+
+TinyPICOScheduler::TinyPICOScheduler( uint8_t maxJobsPerTick )
+{
+    numJobs = 0;
+    profiler = NULL;
+    maxPerTick = maxJobsPerTick > 0 ? maxJobsPerTick : 1;
+}
+
+int TinyPICOScheduler::AddJob( const char *name, schedulerJobFn fn, void *context, uint32_t periodMs, uint32_t deadlineMs )
+{
+    if ( numJobs >= SCHEDULER_MAX_JOBS || fn == NULL || periodMs == 0 )
+        return -1;
+
+    TinyPICOJob &j = jobs[ numJobs ];
+    memset( &j, 0, sizeof( j ) );
+    j.name = name;
+    j.fn = fn;
+    j.context = context;
+    j.period = periodMs * 1000;
+    j.deadline = ( deadlineMs > 0 ? deadlineMs : periodMs ) * 1000;
+    j.release = micros() + ( numJobs * SCHEDULER_PHASE_STEP_US ) % j.period;
+    j.enabled = true;
+    j.marker = profiler != NULL ? profiler->AddMarker( name ) : -1;
+
+    return numJobs++;
+}
+
+void TinyPICOScheduler::SetEnabled( int job, bool enabled )
+{
+    if ( job < 0 || job >= numJobs )
+        return;
+
+    // Re-enabled jobs start from now rather than trying to catch up
+    if ( enabled && !jobs[ job ].enabled )
+        jobs[ job ].release = micros();
+
+    jobs[ job ].enabled = enabled;
+}
+
+void TinyPICOScheduler::UseProfiler( TinyPICOProfiler &p )
+{
+    profiler = &p;
+
+    // jobs added from here on get theirs in AddJob()
+    for ( int i = 0; i < numJobs; i++ )
+    {
+        if ( jobs[ i ].marker < 0 )
+            jobs[ i ].marker = profiler->AddMarker( jobs[ i ].name );
+    }
+}
+
+void TinyPICOScheduler::Trigger( int job )
+{
+    if ( job < 0 || job >= numJobs )
+        return;
+
+    jobs[ job ].release = micros();
+}
+
+void TinyPICOScheduler::SetPeriod( int job, uint32_t periodMs )
+{
+    if ( job < 0 || job >= numJobs || periodMs == 0 )
+        return;
+
+    // a deadline that tracked the period keeps tracking it
+    if ( jobs[ job ].deadline == jobs[ job ].period )
+        jobs[ job ].deadline = periodMs * 1000;
+    jobs[ job ].period = periodMs * 1000;
+}
+
+uint8_t TinyPICOScheduler::Tick()
+{
+    uint8_t ran = 0;
+
+    while ( ran < maxPerTick )
+    {
+        uint32_t now = micros();
+
+        // Earliest deadline first among the jobs that are due.
+        // All comparisons are on differences so they survive micros() wrapping.
+        int next = -1;
+        int32_t nextSlack = 0;
+        for ( int i = 0; i < numJobs; i++ )
+        {
+            TinyPICOJob &j = jobs[ i ];
+            if ( !j.enabled || (int32_t)( now - j.release ) < 0 )
+                continue;
+
+            int32_t slack = (int32_t)( j.release + j.deadline - now );
+            if ( next < 0 || slack < nextSlack )
+            {
+                next = i;
+                nextSlack = slack;
+            }
+        }
+
+        if ( next < 0 )
+            break;
+
+        TinyPICOJob &j = jobs[ next ];
+        uint32_t late = now - j.release;
+
+        j.runs++;
+        j.jitterTotal += late;
+        if ( late > j.jitterMax )
+            j.jitterMax = late;
+        if ( late > j.deadline )
+            j.misses++;
+
+        j.fn( j.context );
+
+        uint32_t duration = micros() - now;
+        if ( duration > j.durationMax )
+            j.durationMax = duration;
+        if ( profiler != NULL )
+            profiler->RecordUs( j.marker, duration );
+
+        // Next release stays on the original grid so the job doesn't drift.
+        // If we're more than a period behind, drop the lost periods instead of running back to back.
+        j.release += j.period;
+        if ( (int32_t)( now - j.release ) >= 0 )
+        {
+            uint32_t behind = ( now - j.release ) / j.period + 1;
+            j.skipped += behind;
+            j.release += behind * j.period;
+        }
+
+        ran++;
+    }
+
+    return ran;
+}
+
+uint32_t TinyPICOScheduler::GetTimeToNextJob()
+{
+    uint32_t now = micros();
+    uint32_t soonest = 0xFFFFFFFF;
+
+    for ( int i = 0; i < numJobs; i++ )
+    {
+        TinyPICOJob &j = jobs[ i ];
+        if ( !j.enabled )
+            continue;
+
+        int32_t until = (int32_t)( j.release - now );
+        if ( until <= 0 )
+            return 0;
+        if ( (uint32_t)until < soonest )
+            soonest = until;
+    }
+
+    return soonest;
+}
+
+const TinyPICOJob *TinyPICOScheduler::GetJob( int job )
+{
+    if ( job < 0 || job >= numJobs )
+        return NULL;
+    return &jobs[ job ];
+}
+
+void TinyPICOScheduler::ResetStats()
+{
+    for ( int i = 0; i < numJobs; i++ )
+    {
+        jobs[ i ].runs = 0;
+        jobs[ i ].misses = 0;
+        jobs[ i ].skipped = 0;
+        jobs[ i ].jitterMax = 0;
+        jobs[ i ].jitterTotal = 0;
+        jobs[ i ].durationMax = 0;
+    }
+}
+
+void TinyPICOScheduler::PrintStats( Print &out )
+{
+    out.printf( "%-10s %8s %8s %6s %6s %9s %9s %9s\r\n", "Job", "Period", "Runs", "Miss", "Skip", "JitAvg", "JitMax", "DurMax" );
+    for ( int i = 0; i < numJobs; i++ )
+    {
+        TinyPICOJob &j = jobs[ i ];
+        uint32_t n = j.runs > 0 ? j.runs : 1;
+        out.printf( "%-10s %8u %8u %6u %6u %9u %9u %9u\r\n", j.name, j.period, j.runs, j.misses, j.skipped,
+                    (uint32_t)( j.jitterTotal / n ), j.jitterMax, j.durationMax );
+    }
+}
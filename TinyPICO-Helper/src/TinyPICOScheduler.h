@@ -0,0 +1,74 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - Cooperative sensor scheduler
+//
+// Runs periodic jobs (IMU, light sensor, battery, ADC channels...) from loop()
+// instead of hand rolled millis() comparisons. Jobs are released on a fixed
+// grid so they don't drift, the clock comparisons are wrap safe, at most a
+// few jobs run per tick (earliest deadline first) so reads don't all land on
+// the bus at once, and each job keeps its own jitter and deadline miss stats.
+// ---------------------------------------------------------------------------
+
+#ifndef TinyPICOScheduler_h
+	#define TinyPICOScheduler_h
+
+	#include <Arduino.h>
+	#include "TinyPICOProfiler.h"
+
+	#define SCHEDULER_MAX_JOBS 8
+
+	typedef void (*schedulerJobFn)( void *context );
+
+	struct TinyPICOJob
+	{
+		const char *name;
+		schedulerJobFn fn;
+		void *context;
+		uint32_t period;        // us
+		uint32_t deadline;      // us after release
+		uint32_t release;       // micros() the job is next due
+		bool enabled;
+
+		// stats
+		uint32_t runs;
+		uint32_t misses;        // started after its deadline
+		uint32_t skipped;       // whole periods lost because we fell behind
+		uint32_t jitterMax;     // us between release and start
+		uint64_t jitterTotal;
+		uint32_t durationMax;   // us spent in the job
+		int marker;             // profiler marker, or -1
+	};
+
+	class TinyPICOScheduler
+	{
+		public:
+			TinyPICOScheduler( uint8_t maxJobsPerTick = 1 );
+
+			// returns a job id, or -1 if the job table is full
+			// deadlineMs of 0 means the job must start within its period
+			int AddJob( const char *name, schedulerJobFn fn, void *context, uint32_t periodMs, uint32_t deadlineMs = 0 );
+			void SetEnabled( int job, bool enabled );
+			void Trigger( int job );                    // run as soon as possible, then continue from there
+			void SetPeriod( int job, uint32_t periodMs );
+
+			// times every job run into the profiler, as a marker named after the job
+			void UseProfiler( TinyPICOProfiler &profiler );
+
+			// call every loop - runs up to maxJobsPerTick due jobs
+			uint8_t Tick();
+
+			// us until the next enabled job is due - 0 if one is due now, 0xFFFFFFFF if there are none
+			// (how long the caller can sleep without making a job late)
+			uint32_t GetTimeToNextJob();
+
+			const TinyPICOJob *GetJob( int job );
+			void ResetStats();
+			void PrintStats( Print &out );
+
+		private:
+			TinyPICOJob jobs[ SCHEDULER_MAX_JOBS ];
+			uint8_t numJobs;
+			uint8_t maxPerTick;
+			TinyPICOProfiler *profiler;
+	};
+
+#endif
@@ -0,0 +1,82 @@
+// ---------------------------------------------------------------------------
+// TinyPICO Helper Library - Lock free state snapshots between tasks
+//
+// A triple buffer for handing a state struct (sensor readings, button
+// events...) from one task to another, usually across cores. The writer
+// fills in a whole struct and calls Write(), the reader calls Read() and
+// gets the newest complete one. Neither side ever waits for the other - the
+// writer always has a spare buffer to write into, and the reader keeps the
+// last snapshot until a newer one has been published. Snapshots the reader
+// didn't get to in time are simply replaced, so only the latest state is
+// passed on, not every change.
+//
+// One writer task and one reader task per snapshot. Anything that must not
+// be missed (button clicks, say) should be a counter in the state, so the
+// reader can tell how many happened since it last looked.
+//
+// Header only, as it is a template.
+// ---------------------------------------------------------------------------
+
+#ifndef TinyPICOSnapshot_h
+	#define TinyPICOSnapshot_h
+
+	#include <stdint.h>
+
+	template <typename T>
+	class TinyPICOSnapshot
+	{
+		public:
+			TinyPICOSnapshot() : buffers(), front( 0 ), middle( 1 ), back( 2 ), published( 0 ) {}
+
+			// Writer side - copies state in and publishes it
+			void Write( const T &state )
+			{
+				buffers[ back ] = state;
+				Publish();
+			}
+
+			// Writer side, without the copy - fill in all of Back() and then Publish().
+			// Back() is not the last state written, so don't update it piecemeal.
+			T &Back() { return buffers[ back ]; }
+			void Publish()
+			{
+				// hand the back buffer over, marked fresh, and take whichever one was in the middle
+				back = __atomic_exchange_n( &middle, back | SNAPSHOT_FRESH, __ATOMIC_ACQ_REL ) & SNAPSHOT_INDEX;
+				published++;
+			}
+
+			// Reader side - true if there was a newer snapshot than last time
+			bool Update()
+			{
+				if ( !( __atomic_load_n( &middle, __ATOMIC_ACQUIRE ) & SNAPSHOT_FRESH ) )
+					return false;
+
+				front = __atomic_exchange_n( &middle, front, __ATOMIC_ACQ_REL ) & SNAPSHOT_INDEX;
+				return true;
+			}
+
+			// the snapshot Update() last picked up - stays put until the next Update()
+			const T &Front() const { return buffers[ front ]; }
+
+			bool Read( T &state )
+			{
+				bool fresh = Update();
+				state = buffers[ front ];
+				return fresh;
+			}
+
+			// writer side count, for stats
+			uint32_t GetPublished() const { return published; }
+
+		private:
+			static const uint8_t SNAPSHOT_INDEX = 0x03;
+			static const uint8_t SNAPSHOT_FRESH = 0x04;
+
+			T buffers[ 3 ];
+			uint8_t front;      // reader only
+			uint8_t middle;     // shared, index plus the fresh flag
+			uint8_t back;       // writer only
+			uint32_t published;
+	};
+
+#endif
@@ -0,0 +1,142 @@
+/*
+   Times the TinyPICOColor buffer kernels against the float maths they replace, and checks they
+   stay within one step of it
+
+   Build:   g++ -O2 -o color_bench tools/color_bench.cpp -lm
+   Usage:   color_bench [iterations]
+
+   Prints the worst difference of each kernel from the float version (exiting non zero if one is more
+   than a single step out), then host nanoseconds per byte for both. Only the ratios say anything
+   about the ESP32, which has a single precision FPU but still pays for the int/float conversions.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <chrono>
+#include "../src/TinyPICOColor.h"
+
+using namespace TinyPICOColor;
+
+// an 8x8 matrix and a long strip, 3 bytes a pixel
+static const size_t sizes[] = { 64 * 3, 1024 * 3 };
+#define MAX_BYTES (1024 * 3)
+
+static int failures = 0;
+
+static uint8_t bufA[MAX_BYTES], bufB[MAX_BYTES], out[MAX_BYTES];
+
+static void scaleFloat(uint8_t *dst, const uint8_t *src, size_t n, uint8_t scale)
+{
+  float s = scale / 255.0f;
+  for (size_t i = 0; i < n; i++)
+    dst[i] = (uint8_t)(src[i] * s + 0.5f);
+}
+
+static void blendFloat(uint8_t *dst, const uint8_t *a, const uint8_t *b, size_t n, uint8_t amount)
+{
+  float t = amount / 255.0f;
+  for (size_t i = 0; i < n; i++)
+    dst[i] = (uint8_t)(a[i] + (b[i] - a[i]) * t + 0.5f);
+}
+
+static void gammaFloat(uint8_t *dst, const uint8_t *src, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    dst[i] = (uint8_t)(powf(src[i] / 255.0f, 2.8f) * 255.0f + 0.5f);
+}
+
+static void report(const char *name, int worst)
+{
+  bool ok = worst <= 1;
+  printf("%-12s worst %d step%s %s\n", name, worst, worst == 1 ? "" : "s", ok ? "ok" : "FAIL");
+  if (!ok)
+    failures++;
+}
+
+// every input and every scale / amount, one value at a time
+static void checkAccuracy()
+{
+  int worst = 0;
+  for (int v = 0; v < 256; v++)
+    for (int s = 0; s < 256; s++)
+    {
+      uint8_t a = v, fixed, ref;
+      ScaleBuffer(&fixed, &a, 1, s);
+      scaleFloat(&ref, &a, 1, s);
+      worst = abs(fixed - ref) > worst ? abs(fixed - ref) : worst;
+    }
+  report("ScaleBuffer", worst);
+
+  worst = 0;
+  for (int a = 0; a < 256; a++)
+    for (int b = 0; b < 256; b++)
+      for (int t = 0; t < 256; t += 5)
+      {
+        uint8_t va = a, vb = b, fixed, ref;
+        BlendBuffer(&fixed, &va, &vb, 1, t);
+        blendFloat(&ref, &va, &vb, 1, t);
+        worst = abs(fixed - ref) > worst ? abs(fixed - ref) : worst;
+      }
+  report("BlendBuffer", worst);
+
+  worst = 0;
+  for (int v = 0; v < 256; v++)
+  {
+    uint8_t a = v, fixed, ref;
+    GammaBuffer(&fixed, &a, 1);
+    gammaFloat(&ref, &a, 1);
+    worst = abs(fixed - ref) > worst ? abs(fixed - ref) : worst;
+  }
+  report("GammaBuffer", worst);
+}
+
+template <typename Fn> static double timeNs(size_t n, long iterations, Fn fn)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < iterations; i++)
+  {
+    fn(n, (uint8_t)i);
+    // keeps the compiler from dropping or hoisting the work
+    asm volatile("" : : "r"(out) : "memory");
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / ((double)iterations * n);
+}
+
+static void benchmark(long iterations)
+{
+  for (size_t i = 0; i < MAX_BYTES; i++)
+  {
+    bufA[i] = rand();
+    bufB[i] = rand();
+  }
+
+  printf("\nns per byte (%ld passes)\n", iterations);
+  printf("%-12s %6s %10s %10s\n", "Kernel", "Bytes", "Integer", "Float");
+  for (size_t n : sizes)
+  {
+    double fixed = timeNs(n, iterations, [](size_t n, uint8_t k) { ScaleBuffer(out, bufA, n, k); });
+    double ref = timeNs(n, iterations, [](size_t n, uint8_t k) { scaleFloat(out, bufA, n, k); });
+    printf("%-12s %6zu %10.3f %10.3f\n", "ScaleBuffer", n, fixed, ref);
+
+    fixed = timeNs(n, iterations, [](size_t n, uint8_t k) { BlendBuffer(out, bufA, bufB, n, k); });
+    ref = timeNs(n, iterations, [](size_t n, uint8_t k) { blendFloat(out, bufA, bufB, n, k); });
+    printf("%-12s %6zu %10.3f %10.3f\n", "BlendBuffer", n, fixed, ref);
+
+    fixed = timeNs(n, iterations, [](size_t n, uint8_t) { GammaBuffer(out, bufA, n); });
+    ref = timeNs(n, iterations, [](size_t n, uint8_t) { gammaFloat(out, bufA, n); });
+    printf("%-12s %6zu %10.3f %10.3f\n", "GammaBuffer", n, fixed, ref);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  long iterations = argc > 1 ? atol(argv[1]) : 20000;
+
+  checkAccuracy();
+  benchmark(iterations);
+
+  return failures ? 1 : 0;
+}
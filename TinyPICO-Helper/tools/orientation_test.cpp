@@ -0,0 +1,252 @@
+/*
+   Checks the fixed point orientation kernels against libm, and times them against the float and
+   double versions they replace
+
+   Build:   g++ -O2 -o orientation_test tools/orientation_test.cpp -lm
+   Usage:   orientation_test [iterations]
+
+   Prints the worst error of each kernel and exits non zero if one is outside what
+   TinyPICOOrientation.h promises. The timings are host nanoseconds per sample - only the ratios
+   between them say anything about the ESP32, where double maths is software emulated and the gap
+   is much wider.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <chrono>
+
+// The kernels only need AccelSample from the accelerometer driver, which doesn't build off target
+#define TinyPICOAccel_h
+struct AccelSample
+{
+  int16_t x;
+  int16_t y;
+  int16_t z;
+};
+
+#include "../src/TinyPICOOrientation.cpp"
+
+#define ATAN2_MAX_ERROR 11      // centidegrees, from the header
+#define INVSQRT_MAX_ERROR 2     // Q16.16 LSBs, from truncating in the Newton steps
+// Pitch also takes the integer square root's rounding, which only matters for short vectors. 1g is
+// about 1300 counts at the 16g range, so anything shorter than this is the sensor in free fall.
+#define PITCH_MAX_ERROR 15
+#define PITCH_MIN_MAGNITUDE 1000
+#define BLOCK 32
+
+static int failures = 0;
+
+static double centidegrees(double radians)
+{
+  return radians * 18000.0 / M_PI;
+}
+
+// difference between two angles the short way round
+static double angleError(double a, double b)
+{
+  double d = fabs(a - b);
+  return d > 18000.0 ? 36000.0 - d : d;
+}
+
+static uint32_t randState = 12345;
+
+static uint32_t rand32()
+{
+  randState ^= randState << 13;
+  randState ^= randState >> 17;
+  randState ^= randState << 5;
+  return randState;
+}
+
+static void report(const char *name, double worst, double limit, const char *units)
+{
+  bool ok = worst <= limit;
+  printf("%-14s worst %10.6f %s (limit %g) %s\n", name, worst, units, limit, ok ? "ok" : "FAIL");
+  if (!ok)
+    failures++;
+}
+
+static void testAtan2()
+{
+  double worst = 0;
+
+  // every 0.01 degree round the circle, at radii from a few counts up to where the kernel has to shift down
+  static const double radii[] = { 50, 1000, 16384, 1 << 20, 1 << 30 };
+  for (double r : radii)
+  {
+    for (int a = -18000; a < 18000; a++)
+    {
+      double t = a * M_PI / 18000.0;
+      int32_t x = (int32_t)lround(r * cos(t));
+      int32_t y = (int32_t)lround(r * sin(t));
+      if (x == 0 && y == 0)
+        continue;
+      double e = angleError(FixedAtan2(y, x), centidegrees(atan2((double)y, (double)x)));
+      if (e > worst)
+        worst = e;
+    }
+  }
+
+  for (int i = 0; i < 1000000; i++)
+  {
+    int32_t x = (int32_t)rand32();
+    int32_t y = (int32_t)rand32();
+    double e = angleError(FixedAtan2(y, x), centidegrees(atan2((double)y, (double)x)));
+    if (e > worst)
+      worst = e;
+  }
+
+  report("FixedAtan2", worst, ATAN2_MAX_ERROR, "cdeg");
+}
+
+static bool sqrtExact(uint32_t x)
+{
+  uint64_t r = FixedSqrt(x);
+  return r * r <= x && (r + 1) * (r + 1) > x;
+}
+
+static void testSqrt()
+{
+  uint32_t wrong = 0;
+
+  // every value an accelerometer sum of squares can reach, then the rest of the range at random
+  for (uint32_t x = 0; x < (1UL << 24); x++)
+    if (!sqrtExact(x))
+      wrong++;
+  for (int i = 0; i < 1000000; i++)
+    if (!sqrtExact(rand32()))
+      wrong++;
+  if (!sqrtExact(0xFFFFFFFF))
+    wrong++;
+
+  report("FixedSqrt", wrong, 0, "wrong");
+}
+
+static void testInvSqrt()
+{
+  double worst = 0;
+
+  // large x leaves only a few bits of result in Q16.16, so this is judged in LSBs rather than relative error
+  for (uint32_t x = 1; x < (1UL << 20); x++)
+  {
+    double e = fabs(FixedInvSqrt(x) - 65536.0 / sqrt((double)x));
+    if (e > worst)
+      worst = e;
+  }
+  for (int i = 0; i < 1000000; i++)
+  {
+    uint32_t x = rand32() | 1;
+    double e = fabs(FixedInvSqrt(x) - 65536.0 / sqrt((double)x));
+    if (e > worst)
+      worst = e;
+  }
+
+  report("FixedInvSqrt", worst, INVSQRT_MAX_ERROR, "lsb");
+}
+
+// samples as the LIS3DH hands them over, left justified 12 bits at any range
+static void randomSamples(AccelSample *samples, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    samples[i].x = (int16_t)(rand32() & 0xFFF0);
+    samples[i].y = (int16_t)(rand32() & 0xFFF0);
+    samples[i].z = (int16_t)(rand32() & 0xFFF0);
+  }
+}
+
+static void testRollPitch()
+{
+  double worstRoll = 0, worstPitch = 0;
+  AccelSample samples[BLOCK];
+  int16_t roll[BLOCK], pitch[BLOCK];
+
+  for (int n = 0; n < 100000; n++)
+  {
+    randomSamples(samples, BLOCK);
+    FixedRollPitchBlock(samples, BLOCK, roll, pitch);
+    for (int i = 0; i < BLOCK; i++)
+    {
+      double x = samples[i].x, y = samples[i].y, z = samples[i].z;
+      double er = angleError(roll[i], centidegrees(atan2(y, z)));
+      if (er > worstRoll)
+        worstRoll = er;
+
+      if (sqrt(x * x + y * y + z * z) < PITCH_MIN_MAGNITUDE)
+        continue;
+      double ep = angleError(pitch[i], centidegrees(atan2(-x, sqrt(y * y + z * z))));
+      if (ep > worstPitch)
+        worstPitch = ep;
+    }
+  }
+
+  report("Roll", worstRoll, ATAN2_MAX_ERROR, "cdeg");
+  report("Pitch", worstPitch, PITCH_MAX_ERROR, "cdeg");
+}
+
+// keeps the compiler from throwing the results away
+static volatile int32_t sink;
+
+template <typename Fn> static double timeNs(const AccelSample *samples, int count, long iterations, Fn fn)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (long n = 0; n < iterations; n++)
+    sink = fn(samples, count);
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / ((double)iterations * count);
+}
+
+static void benchmark(long iterations)
+{
+  AccelSample samples[BLOCK];
+  randomSamples(samples, BLOCK);
+
+  double fixed = timeNs(samples, BLOCK, iterations, [](const AccelSample *s, int count) {
+    int16_t roll[BLOCK], pitch[BLOCK];
+    FixedRollPitchBlock(s, count, roll, pitch);
+    int32_t sum = 0;
+    for (int i = 0; i < count; i++)
+      sum += roll[i] + pitch[i];
+    return sum;
+  });
+
+  double single = timeNs(samples, BLOCK, iterations, [](const AccelSample *s, int count) {
+    int32_t sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+      float x = s[i].x, y = s[i].y, z = s[i].z;
+      sum += (int32_t)(atan2f(y, z) * 5729.578f) + (int32_t)(atan2f(-x, sqrtf(y * y + z * z)) * 5729.578f);
+    }
+    return sum;
+  });
+
+  double dbl = timeNs(samples, BLOCK, iterations, [](const AccelSample *s, int count) {
+    int32_t sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+      double x = s[i].x, y = s[i].y, z = s[i].z;
+      sum += (int32_t)(atan2(y, z) * 5729.578) + (int32_t)(atan2(-x, sqrt(y * y + z * z)) * 5729.578);
+    }
+    return sum;
+  });
+
+  printf("\nRoll and pitch, ns per sample (%ld blocks of %d):\n", iterations, BLOCK);
+  printf("  fixed  %8.2f\n", fixed);
+  printf("  float  %8.2f\n", single);
+  printf("  double %8.2f\n", dbl);
+}
+
+int main(int argc, char **argv)
+{
+  long iterations = argc > 1 ? atol(argv[1]) : 100000;
+
+  testAtan2();
+  testSqrt();
+  testInvSqrt();
+  testRollPitch();
+  benchmark(iterations);
+
+  return failures ? 1 : 0;
+}
@@ -43,6 +43,7 @@
 
 #include "Arduino.h"
 #include "TinyPICOExpander.h"
+#include "TerminalDashboard.h"
 
 typedef enum
 {
@@ -53,8 +54,7 @@ typedef enum
 
 TinyPICOExpander tpio = TinyPICOExpander();
 
-volatile bool handleInterrupt = false;
-volatile int interruptFires = 0; // count the number of times an interrupt has been fired
+int interruptFires = 0;          // count the number of interrupt events processed
 int callbackFires = 0;           // count the number of times a callback has been called
 int cyclePort = 0;               // current port number that is being set in togglePorts
 
@@ -63,6 +63,14 @@ int gainSetting = 0x00;
 
 unsigned long lastToggle;
 
+// fields on the debug screen that change, laid over the static frame from drawScreen()
+// the dashboard keeps a copy of what is on the terminal and only sends the fields that changed
+UM_TerminalDashboard dash(Serial);
+int fieldPin[16];
+int fieldPorts, fieldPortA, fieldPortB;
+int fieldAdcBits[4], fieldAdcValue[4];
+int fieldGain;
+
 // Routine to print int as binary with leading zeros
 void printBits(uint16_t b, int bits)
 {
@@ -70,23 +78,16 @@ void printBits(uint16_t b, int bits)
     Serial.print(bitRead(b, i));
 }
 
-// routine called as interrupt handler / ISR to flag interrupt process required
+// routine called for each queued interrupt event
 // we don't read the MCP23017 ports via I2C during an interrupt as it will create watchdog &  issues
-// we set a bool flag and process the interrupt via the main loop
-void InterruptFlag()
+// the library's ISR queues a timestamped edge and tpio.processInterrupts() in the main loop resolves it
+// over I2C into the pin and value that caused it, so a burst of edges isn't collapsed into one
+void ProcessInterrupt(uint32_t timeUs, uint8_t pin, uint8_t value, uint16_t missed)
 {
-  handleInterrupt = true;
   interruptFires++;
-}
-
-// code called when the interrupt flag is processed
-void ProcessInterrupt()
-{
-  // detachInterrupt(27);
   Serial.printf("\033[13;0H");
-  Serial.printf("| Interrupt! - Pin: %03d | Value: %03d | Fires: %03d\r\n", tpio.getLastInterruptPin(), tpio.getLastInterruptPinValue(), interruptFires);
+  Serial.printf("| Interrupt! - Pin: %03d | Value: %03d | Fires: %03d\r\n", pin, value, interruptFires);
   Serial.printf("\033[H");
-  // attachInterrupt(27, InterruptFlag, FALLING);
 }
 
 // test code to cycle and stagger port bits for testing
@@ -171,125 +172,98 @@ void drawScreen()
   Serial.println("| \033[38;5;242mDigital: [BUTTON1-4] - Generate Callback                                    [BUTTON3-4] - Generate Interrupt                   \033[m |");
   Serial.println("| \033[38;5;242m Analog: [BUTTON1]   - Switch Analog Mode (Single|Differential|Comparator)  [BUTTON2]   - Cycle Gain (2/3x|1x|2x|4x|8x|16x)    \033[m |");
   Serial.println("`---------------------------------------------------------------+-----------------------------------------------------------------'");
+
+  // the frame just overwrote every field
+  dash.invalidate();
+}
+
+void setupDashboard()
+{
+  static const uint8_t adcCol[4] = {6, 42, 80, 114};
+
+  for (int i = 0; i < 16; i++)
+    fieldPin[i] = dash.addField(i < 8 ? 7 : 10, 11 + (i % 8) * 16, 1);
+
+  fieldPorts = dash.addField(13, 74, 16);
+  fieldPortA = dash.addField(13, 102, 8);
+  fieldPortB = dash.addField(13, 122, 8);
+
+  for (int i = 0; i < 4; i++)
+  {
+    fieldAdcBits[i] = dash.addField(21, adcCol[i], 16);
+    fieldAdcValue[i] = dash.addField(22, adcCol[i], 16);
+  }
+
+  fieldGain = dash.addField(25, 9, 4);
+}
+
+void setAdcField(int channel, uint16_t value)
+{
+  dash.setBits(fieldAdcBits[channel], value, 16);
+  dash.setUnsigned(fieldAdcValue[channel], value);
 }
 
 // update only values for debug screen via serial output
 void updateScreen()
 {
-  // GPIO
-
-  Serial.printf("\033[7;11H%d", tpio.digitalRead(0));
-  Serial.printf("\033[7;27H%d", tpio.digitalRead(1));
-  Serial.printf("\033[7;43H%d", tpio.digitalRead(2));
-  Serial.printf("\033[7;59H%d", tpio.digitalRead(3));
-
-  Serial.printf("\033[7;75H%d", tpio.digitalRead(4));
-  Serial.printf("\033[7;91H%d", tpio.digitalRead(5));
-  Serial.printf("\033[7;107H%d", tpio.digitalRead(6));
-  Serial.printf("\033[7;123H%d", tpio.digitalRead(7));
-
-  Serial.printf("\033[10;11H%d", tpio.digitalRead(8));
-  Serial.printf("\033[10;27H%d", tpio.digitalRead(9));
-  Serial.printf("\033[10;43H%d", tpio.digitalRead(10));
-  Serial.printf("\033[10;59H%d", tpio.digitalRead(11));
-
-  Serial.printf("\033[10;75H%d", tpio.digitalRead(12));
-  Serial.printf("\033[10;91H%d", tpio.digitalRead(13));
-  Serial.printf("\033[10;107H%d", tpio.digitalRead(14));
-  Serial.printf("\033[10;123H%d", tpio.digitalRead(15));
-
-  Serial.print("\033[13;67HPorts: ");
-  printBits(tpio.readPorts(), 16);
-  Serial.print(" |  PortA : ");
-  printBits(tpio.readPorts(MCP23017_GPIOA), 8);
-  Serial.print(" |  PortB : ");
-  printBits(tpio.readPorts(MCP23017_GPIOB), 8);
-  Serial.print(" |\r\n");
+  // GPIO - one read of both ports, everything else is derived from it
+  uint16_t ports = tpio.readPorts();
 
-  // ADC
-  uint16_t value;
+  for (int i = 0; i < 16; i++)
+    dash.setText(fieldPin[i], bitRead(ports, i) ? "1" : "0");
 
+  dash.setBits(fieldPorts, ports, 16);
+  dash.setBits(fieldPortA, ports & 0xFF, 8);
+  dash.setBits(fieldPortB, ports >> 8, 8);
+
+  // ADC
   switch (adsMode)
   {
   case Single:
-    value = tpio.analogReadSingleEnded(0);
-    Serial.print("\033[21;6H");
-    printBits(value, 16);
-    Serial.print("\033[22;6H");
-    Serial.printf("%16u", value);
-
-    value = tpio.analogReadSingleEnded(1);
-    Serial.print("\033[21;42H");
-    printBits(value, 16);
-    Serial.print("\033[22;42H");
-    Serial.printf("%16u", value);
-
-    value = tpio.analogReadSingleEnded(2);
-    Serial.print("\033[21;80H");
-    printBits(value, 16);
-    Serial.print("\033[22;80H");
-    Serial.printf("%16u", value);
-
-    value = tpio.analogReadSingleEnded(3);
-    Serial.print("\033[21;114H");
-    printBits(value, 16);
-    Serial.print("\033[22;114H");
-    Serial.printf("%16u", value);
+    for (int i = 0; i < 4; i++)
+      setAdcField(i, tpio.analogReadSingleEnded(i));
     break;
   case Differential:
-    value = tpio.analogReadDifferential(0);
-    Serial.print("\033[21;6H");
-    printBits(value, 16);
-    Serial.print("\033[22;6H");
-    Serial.printf("%16u", value);
-
-    Serial.print("\033[21;42H----------------");
-    Serial.print("\033[22;42H----------------");
-
-    value = tpio.analogReadDifferential(1);
-    Serial.print("\033[21;80H");
-    printBits(value, 16);
-    Serial.print("\033[22;80H");
-    Serial.printf("%16u", value);
-
-    Serial.print("\033[21;114H----------------");
-    Serial.print("\033[22;114H----------------");
+    setAdcField(0, tpio.analogReadDifferential(0));
+    setAdcField(2, tpio.analogReadDifferential(1));
+
+    dash.setText(fieldAdcBits[1], "----------------");
+    dash.setText(fieldAdcValue[1], "----------------");
+    dash.setText(fieldAdcBits[3], "----------------");
+    dash.setText(fieldAdcValue[3], "----------------");
     break;
   case Comparator:
-    value = tpio.getLastConversionResults();
-    Serial.print("\033[21;6H");
-    printBits(value, 16);
-    Serial.print("\033[22;6H");
-    Serial.printf("%16u", value);
+    setAdcField(0, tpio.getLastConversionResults());
     break;
   default:
     break;
   }
 
-  Serial.print("\033[25;3HGain: ");
   switch (tpio.analogGetGain())
   {
   case GAIN_TWOTHIRDS:
-    Serial.print("x2/3");
+    dash.setText(fieldGain, "x2/3");
     break;
   case GAIN_ONE:
-    Serial.print("x1  ");
+    dash.setText(fieldGain, "x1");
     break;
   case GAIN_TWO:
-    Serial.print("x2  ");
+    dash.setText(fieldGain, "x2");
     break;
   case GAIN_FOUR:
-    Serial.print("x4  ");
+    dash.setText(fieldGain, "x4");
     break;
   case GAIN_EIGHT:
-    Serial.print("x8  ");
+    dash.setText(fieldGain, "x8");
     break;
   case GAIN_SIXTEEN:
-    Serial.print("x16 ");
+    dash.setText(fieldGain, "x16");
     break;
   default:
     break;
   }
+
+  dash.flush();
 }
 
 // routine called when port changes state. This is an alternative to using interrupts
@@ -367,25 +341,22 @@ void setup()
   tpio.setupInterruptPin(7, FALLING);
   tpio.setupInterruptPin(6, FALLING);
 
-  pinMode(27, INPUT);
-  attachInterrupt(27, InterruptFlag, FALLING);
+  tpio.RegisterInterruptCB(ProcessInterrupt);
+  tpio.attachInterruptQueue(27, FALLING);
 
   // register after pin setup.
   // In this example we only want to create call back events for the buttons and not for the changes made in the togglePorts function
   // to do this we pass in a bit mask to register callback. The value 0xF0 represents ports 4-7 / 0000 0000 1111 0000.
   tpio.RegisterChangeCB(GPIOChangeCallback, 0xF0);
 
+  setupDashboard();
   drawScreen();
 }
 
 void loop()
 {
-  // process interrupt if ISR handler is flagged
-  if (handleInterrupt)
-  {
-    handleInterrupt = false;
-    ProcessInterrupt();
-  }
+  // process any interrupt edges queued by the ISR
+  tpio.processInterrupts();
 
   togglePorts();
   updateScreen();
@@ -11,15 +11,19 @@ void setup()
 
   tpio.begin();
   tpio.analogSetGain(GAIN_TWOTHIRDS);
+
+  // Use the calibration saved by UM_ADS1015::saveCalibration(), if there is one
+  if (!tpio.loadCalibration())
+    Serial.println("No saved calibration, using the nominal scale");
 }
 
 void loop()
 {
-  Serial.printf("A0: %06u | A1: %06u | A2: %06u | A3: %06u\r\n",
-                tpio.analogReadSingleEnded(0),
-                tpio.analogReadSingleEnded(1),
-                tpio.analogReadSingleEnded(2),
-                tpio.analogReadSingleEnded(3));
+  Serial.printf("A0: %5d mV | A1: %5d mV | A2: %5d mV | A3: %5d mV\r\n",
+                tpio.analogReadMilliVolts(0),
+                tpio.analogReadMilliVolts(1),
+                tpio.analogReadMilliVolts(2),
+                tpio.analogReadMilliVolts(3));
 
   delay(100);
 }
@@ -1,41 +1,66 @@
 #include "ADS1015.h"
+#include <Preferences.h>
+
+// nominal uV per count for each PGA setting (config bits 11:9), from the +/- full scale over 2048
+static const uint16_t countUv[] = {3000, 2000, 1000, 500, 250, 125, 125, 125};
+
+// calibrate() won't accept a gain correction outside this, it's more likely a wiring mistake
+#define ADS1015_CAL_GAIN_MIN (32768)
+#define ADS1015_CAL_GAIN_MAX (98304)
 
 bool UM_ADS1015::write(uint8_t addr, uint16_t value)
 {
-  Wire.beginTransmission(m_i2cAddress);
-  Wire.write(addr);
-  Wire.write((uint8_t)(value >> 8));
-  Wire.write((uint8_t)(value & 0xFF));
-  if (Wire.endTransmission() == 0)
-    return true;
-  return false;
+  uint8_t buf[3] = {addr, (uint8_t)(value >> 8), (uint8_t)(value & 0xFF)};
+  return m_bus->write(m_dev, buf, 3);
 }
 
 uint16_t UM_ADS1015::read(unsigned int addr)
 {
-  unsigned int value;
-  Wire.beginTransmission(m_i2cAddress);
-  Wire.write(addr);
-  if (Wire.endTransmission(false) != 0)
+  uint8_t reg = addr;
+  uint8_t buf[2];
+  if (!m_bus->writeRead(m_dev, &reg, 1, buf, 2))
     return 0;
-  if (Wire.requestFrom(m_i2cAddress, (uint8_t)2) < 2)
-    return 0;
-  return ((Wire.read() << 8) | Wire.read());
+  return ((uint16_t)buf[0] << 8) | buf[1];
 }
 
-void UM_ADS1015::begin(uint8_t addr)
+void UM_ADS1015::begin(uint8_t addr, UM_I2CBus &bus)
 {
   m_i2cAddress = addr;
   m_conversionDelay = ADS1015_CONVERSIONDELAY;
   m_bitShift = 4;
   m_gain = GAIN_TWOTHIRDS; /* +/- 6.144V range (limited to VDD +0.3V max!) */
+  clearCalibration();
+
+  m_bus = &bus;
+  m_bus->begin();
+  m_dev = m_bus->addDevice(addr, I2C_PRIORITY_NORMAL, "ADS1015");
+}
+
+bool UM_ADS1015::snapshot(UM_ADS1015Snapshot &snap)
+{
+  snap.address = m_i2cAddress;
+  snap.gain = m_gain;
+  memcpy(snap.cal, m_cal, sizeof(m_cal));
+  snap.valid = true;
+  return true;
+}
 
-  Wire.begin();
+bool UM_ADS1015::resume(const UM_ADS1015Snapshot &snap, UM_I2CBus &bus)
+{
+  if (!snap.valid)
+    return false;
+
+  begin(snap.address, bus);
+  m_gain = (adsGain_t)snap.gain;
+  memcpy(m_cal, snap.cal, sizeof(m_cal));
+  updateScale();
+  return true;
 }
 
 void UM_ADS1015::analogSetGain(adsGain_t gain)
 {
   m_gain = gain;
+  updateScale();
 }
 
 adsGain_t UM_ADS1015::analogGetGain()
@@ -43,13 +68,8 @@ adsGain_t UM_ADS1015::analogGetGain()
   return m_gain;
 }
 
-uint16_t UM_ADS1015::analogReadSingleEnded(uint8_t channel)
+uint16_t UM_ADS1015::singleEndedConfig(uint8_t channel)
 {
-  if (channel > 3)
-  {
-    return 0;
-  }
-
   // Start with default values
   uint16_t config = ADS1015_REG_CONFIG_CQUE_NONE |    // Disable the comparator (default val)
                     ADS1015_REG_CONFIG_CLAT_NONLAT |  // Non-latching (default val)
@@ -81,8 +101,26 @@ uint16_t UM_ADS1015::analogReadSingleEnded(uint8_t channel)
   // Set 'start single-conversion' bit
   config |= ADS1015_REG_CONFIG_OS_SINGLE;
 
+  return config;
+}
+
+bool UM_ADS1015::startSingleEnded(uint8_t channel)
+{
+  if (channel > 3)
+  {
+    return false;
+  }
+
   // Write config register to the ADC
-  write(ADS1015_REG_POINTER_CONFIG, config);
+  return write(ADS1015_REG_POINTER_CONFIG, singleEndedConfig(channel));
+}
+
+uint16_t UM_ADS1015::analogReadSingleEnded(uint8_t channel)
+{
+  if (!startSingleEnded(channel))
+  {
+    return 0;
+  }
 
   // Wait for the conversion to complete
   delay(m_conversionDelay);
@@ -92,7 +130,7 @@ uint16_t UM_ADS1015::analogReadSingleEnded(uint8_t channel)
   return read(ADS1015_REG_POINTER_CONVERT) >> m_bitShift;
 }
 
-int16_t UM_ADS1015::analogReadDifferential(uint8_t channel)
+uint16_t UM_ADS1015::differentialConfig(uint8_t channel)
 {
   // Start with default values
   uint16_t config = ADS1015_REG_CONFIG_CQUE_NONE |    // Disable the comparator (default val)
@@ -114,14 +152,12 @@ int16_t UM_ADS1015::analogReadDifferential(uint8_t channel)
   // Set 'start single-conversion' bit
   config |= ADS1015_REG_CONFIG_OS_SINGLE;
 
-  // Write config register to the ADC
-  write(ADS1015_REG_POINTER_CONFIG, config);
-
-  // Wait for the conversion to complete
-  delay(m_conversionDelay);
+  return config;
+}
 
-  // Read the conversion results
-  uint16_t res = read(ADS1015_REG_POINTER_CONVERT) >> m_bitShift;
+int16_t UM_ADS1015::toSigned(uint16_t raw)
+{
+  uint16_t res = raw >> m_bitShift;
   if (m_bitShift == 0)
   {
     return (int16_t)res;
@@ -139,6 +175,50 @@ int16_t UM_ADS1015::analogReadDifferential(uint8_t channel)
   }
 }
 
+int16_t UM_ADS1015::analogReadDifferential(uint8_t channel)
+{
+  // Write config register to the ADC
+  write(ADS1015_REG_POINTER_CONFIG, differentialConfig(channel));
+
+  // Wait for the conversion to complete
+  delay(m_conversionDelay);
+
+  // Read the conversion results
+  return toSigned(read(ADS1015_REG_POINTER_CONVERT));
+}
+
+bool UM_ADS1015::analogReadSingleEndedAsync(uint8_t channel, UM_I2CTransfer &xfer)
+{
+  if (channel > 3)
+  {
+    return false;
+  }
+  return startAsync(singleEndedConfig(channel), xfer);
+}
+
+bool UM_ADS1015::analogReadDifferentialAsync(uint8_t channel, UM_I2CTransfer &xfer)
+{
+  return startAsync(differentialConfig(channel), xfer);
+}
+
+bool UM_ADS1015::startAsync(uint16_t config, UM_I2CTransfer &xfer)
+{
+  // write the config, let the worker wait out the conversion, then read the result
+  uint8_t buf[3] = {ADS1015_REG_POINTER_CONFIG, (uint8_t)(config >> 8), (uint8_t)(config & 0xFF)};
+  xfer.setWriteWaitRead(m_dev, buf, 3, m_conversionDelay * 1000UL, ADS1015_REG_POINTER_CONVERT, 2);
+  return m_bus->submit(xfer);
+}
+
+uint16_t UM_ADS1015::singleEndedResult(const UM_I2CTransfer &xfer)
+{
+  return (((uint16_t)xfer.rx[0] << 8) | xfer.rx[1]) >> m_bitShift;
+}
+
+int16_t UM_ADS1015::differentialResult(const UM_I2CTransfer &xfer)
+{
+  return toSigned(((uint16_t)xfer.rx[0] << 8) | xfer.rx[1]);
+}
+
 void UM_ADS1015::startComparator(uint8_t channel, int16_t threshold)
 {
   // Start with default values
@@ -183,21 +263,138 @@ int16_t UM_ADS1015::getLastConversionResults()
   // Wait for the conversion to complete
   delay(m_conversionDelay);
 
+  return readConversion();
+}
+
+int16_t UM_ADS1015::readConversion()
+{
   // Read the conversion results
-  uint16_t res = read(ADS1015_REG_POINTER_CONVERT) >> m_bitShift;
-  if (m_bitShift == 0)
+  return toSigned(read(ADS1015_REG_POINTER_CONVERT));
+}
+
+uint32_t UM_ADS1015::countMicroVolts(adsGain_t gain)
+{
+  return countUv[(gain >> 9) & 0x07];
+}
+
+void UM_ADS1015::updateScale()
+{
+  // Fold the gain step and each channel's calibration into one Q16 multiplier and offset,
+  // so a conversion is a multiply, a subtract and a shift
+  uint32_t uv = countMicroVolts(m_gain);
+  for (int i = 0; i < ADS1015_CHANNELS; i++)
   {
-    return (int16_t)res;
+    m_uvMul[i] = uv * m_cal[i].gainQ16;
+    m_mvMul[i] = ((int64_t)uv * m_cal[i].gainQ16 + 500) / 1000;
+    m_mvOffset[i] = ((int64_t)m_cal[i].offsetUv * 65536) / 1000;
   }
-  else
+}
+
+void UM_ADS1015::toMilliVolts(const int16_t *counts, int32_t *mv, size_t n, uint8_t channel) const
+{
+  // constants hoisted out, so the loop is a multiply and an add per sample and can be unrolled or vectorised
+  channel &= ADS1015_CHANNELS - 1;
+  const int32_t mul = m_mvMul[channel];
+  const int32_t add = 0x8000 - m_mvOffset[channel];
+  for (size_t i = 0; i < n; i++)
+    mv[i] = (counts[i] * mul + add) >> 16;
+}
+
+void UM_ADS1015::toMicroVolts(const int16_t *counts, int32_t *uv, size_t n, uint8_t channel) const
+{
+  channel &= ADS1015_CHANNELS - 1;
+  const int32_t mul = m_uvMul[channel];
+  const int32_t offset = m_cal[channel].offsetUv;
+  for (size_t i = 0; i < n; i++)
+    uv[i] = (int32_t)(((int64_t)counts[i] * mul + 0x8000) >> 16) - offset;
+}
+
+int32_t UM_ADS1015::averageSingleEnded(uint8_t channel, uint8_t samples)
+{
+  if (samples == 0)
+    samples = 1;
+
+  int32_t total = 0;
+  for (int i = 0; i < samples; i++)
+    total += analogReadSingleEnded(channel);
+
+  return (total << 4) / samples;
+}
+
+bool UM_ADS1015::calibrate(uint8_t channel, int32_t lowAverage, int32_t lowMv, int32_t highAverage, int32_t highMv)
+{
+  if (channel >= ADS1015_CHANNELS)
+    return false;
+
+  // what the nominal scale makes of the two readings, in uV
+  uint32_t uv = countMicroVolts(m_gain);
+  int64_t nominalLow = (int64_t)lowAverage * uv / 16;
+  int64_t nominalHigh = (int64_t)highAverage * uv / 16;
+  if (nominalHigh <= nominalLow || highMv <= lowMv)
+    return false;
+
+  int64_t gain = (((int64_t)(highMv - lowMv) * 1000) << 16) / (nominalHigh - nominalLow);
+  if (gain < ADS1015_CAL_GAIN_MIN || gain > ADS1015_CAL_GAIN_MAX)
+    return false;
+
+  UM_ADS1015Calibration cal;
+  cal.gainQ16 = gain;
+  cal.offsetUv = ((nominalLow * gain) >> 16) - (int64_t)lowMv * 1000;
+  setCalibration(channel, cal);
+  return true;
+}
+
+void UM_ADS1015::setCalibration(uint8_t channel, const UM_ADS1015Calibration &cal)
+{
+  if (channel >= ADS1015_CHANNELS)
+    return;
+
+  m_cal[channel] = cal;
+  updateScale();
+}
+
+void UM_ADS1015::clearCalibration()
+{
+  for (int i = 0; i < ADS1015_CHANNELS; i++)
   {
-    // Shift 12-bit results right 4 bits for the ADS1015,
-    // making sure we keep the sign bit intact
-    if (res > 0x07FF)
-    {
-      // negative number - extend the sign to 16th bit
-      res |= 0xF000;
-    }
-    return (int16_t)res;
+    m_cal[i].offsetUv = 0;
+    m_cal[i].gainQ16 = 65536;
   }
+  updateScale();
+}
+
+bool UM_ADS1015::saveCalibration()
+{
+  Preferences prefs;
+  if (!prefs.begin(ADS1015_CAL_NAMESPACE, false))
+    return false;
+
+  char key[8];
+  snprintf(key, sizeof(key), "cal%02x", m_i2cAddress);
+  bool ok = prefs.putBytes(key, m_cal, sizeof(m_cal)) == sizeof(m_cal);
+  prefs.end();
+  return ok;
+}
+
+bool UM_ADS1015::loadCalibration()
+{
+  Preferences prefs;
+  if (!prefs.begin(ADS1015_CAL_NAMESPACE, true))
+    return false;
+
+  char key[8];
+  snprintf(key, sizeof(key), "cal%02x", m_i2cAddress);
+  UM_ADS1015Calibration cal[ADS1015_CHANNELS];
+  bool ok = prefs.getBytesLength(key) == sizeof(cal) && prefs.getBytes(key, cal, sizeof(cal)) == sizeof(cal);
+  prefs.end();
+
+  // don't take anything calibrate() wouldn't have produced
+  for (int i = 0; ok && i < ADS1015_CHANNELS; i++)
+    ok = cal[i].gainQ16 >= ADS1015_CAL_GAIN_MIN && cal[i].gainQ16 <= ADS1015_CAL_GAIN_MAX;
+  if (!ok)
+    return false;
+
+  memcpy(m_cal, cal, sizeof(m_cal));
+  updateScale();
+  return true;
 }
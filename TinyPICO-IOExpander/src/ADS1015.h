@@ -3,9 +3,13 @@
 
 #include <Arduino.h>
 #include <Wire.h>
+#include "I2CBus.h"
 
 #define ADS1015_ADDRESS (0x48) // 1001 000 (ADDR = GND)
 
+#define ADS1015_CHANNELS (4)
+#define ADS1015_CAL_NAMESPACE "ads1015" // NVS namespace for saveCalibration()
+
 #define ADS1015_CONVERSIONDELAY (1)
 #define ADS1115_CONVERSIONDELAY (8)
 
@@ -79,27 +83,115 @@ typedef enum
     GAIN_SIXTEEN = ADS1015_REG_CONFIG_PGA_0_256V
 } adsGain_t;
 
+// Per channel correction on top of the nominal gain: uV = nominal uV * gain - offsetUv
+struct UM_ADS1015Calibration
+{
+    int32_t offsetUv;
+    uint32_t gainQ16; // 65536 = 1.0
+};
+
+// Driver state for keeping in RTC memory across deep sleep (see UM_MCP23017Snapshot)
+struct UM_ADS1015Snapshot
+{
+    uint8_t valid;
+    uint8_t address;
+    uint16_t gain;
+    UM_ADS1015Calibration cal[ADS1015_CHANNELS];
+};
+
 class UM_ADS1015
 {
 public:
     void begin(void) { begin(ADS1015_ADDRESS); }
-    void begin(uint8_t addr);
+    void begin(uint8_t addr) { begin(addr, I2CBus0); }
+    void begin(uint8_t addr, UM_I2CBus &bus);
+    // Single shot conversions write the whole config with every read, so there are no chip registers
+    // to restore - resume() just brings the driver back without touching the bus. A running
+    // comparator has to be restarted with startComparator().
+    bool snapshot(UM_ADS1015Snapshot &snap);
+    bool resume(const UM_ADS1015Snapshot &snap, UM_I2CBus &bus = I2CBus0);
+    void setBusPriority(i2cPriority_t priority)
+    {
+        if (m_dev)
+            m_dev->priority = priority;
+    }
+    // result of the last bus transaction - reads return 0 on failure, so check this when it matters
+    i2cResult_t lastError() { return m_dev ? m_dev->lastResult : I2C_RESULT_BUSY; }
 
     bool write(uint8_t addr, uint16_t value);
     uint16_t read(unsigned int addr);
     
     uint16_t analogReadSingleEnded(uint8_t channel);
+    // non blocking version - start a conversion now and collect it with readConversion() once it's done
+    bool startSingleEnded(uint8_t channel);
+    int16_t readConversion();
+    uint8_t conversionDelay() { return m_conversionDelay; }
+
+    // Asynchronous reads through the bus worker (see UM_I2CBus::beginAsync)
+    // The conversion wait happens in the worker, so the caller is free until xfer.done()
+    bool analogReadSingleEndedAsync(uint8_t channel, UM_I2CTransfer &xfer);
+    bool analogReadDifferentialAsync(uint8_t channel, UM_I2CTransfer &xfer);
+    uint16_t singleEndedResult(const UM_I2CTransfer &xfer);
+    int16_t differentialResult(const UM_I2CTransfer &xfer);
     int16_t analogReadDifferential(uint8_t channel);
     void startComparator(uint8_t channel, int16_t threshold);
     int16_t getLastConversionResults();
     void analogSetGain(adsGain_t gain);
     adsGain_t analogGetGain(void);
 
+    // Readings in millivolts or microvolts, in fixed point - the per gain scale and the channel's
+    // calibration are folded into one multiplier, so there's no float maths or divide per sample.
+    // channel picks the calibration: the single ended channel, or the positive input (0 or 2) for a differential read.
+    int32_t toMilliVolts(int16_t counts, uint8_t channel = 0) const
+    {
+        channel &= ADS1015_CHANNELS - 1;
+        return (counts * m_mvMul[channel] - m_mvOffset[channel] + 0x8000) >> 16;
+    }
+    int32_t toMicroVolts(int16_t counts, uint8_t channel = 0) const
+    {
+        channel &= ADS1015_CHANNELS - 1;
+        return (int32_t)(((int64_t)counts * m_uvMul[channel] + 0x8000) >> 16) - m_cal[channel].offsetUv;
+    }
+    // whole blocks of samples, for streaming consumers
+    void toMilliVolts(const int16_t *counts, int32_t *mv, size_t n, uint8_t channel = 0) const;
+    void toMicroVolts(const int16_t *counts, int32_t *uv, size_t n, uint8_t channel = 0) const;
+    int32_t analogReadMilliVolts(uint8_t channel) { return toMilliVolts(analogReadSingleEnded(channel), channel); }
+    // nominal uV per count at a gain
+    static uint32_t countMicroVolts(adsGain_t gain);
+
+    // Two point calibration - read each channel with two known voltages on it, at the gain it will be used at:
+    //   int32_t low = ads.averageSingleEnded(0);   // with 0.5V applied
+    //   int32_t high = ads.averageSingleEnded(0);  // with 3.0V applied
+    //   ads.calibrate(0, low, 500, high, 3000);
+    //   ads.saveCalibration();
+    // averageSingleEnded() returns the average in 1/16 counts. The gain correction must be within 0.5-1.5.
+    int32_t averageSingleEnded(uint8_t channel, uint8_t samples = 16);
+    bool calibrate(uint8_t channel, int32_t lowAverage, int32_t lowMv, int32_t highAverage, int32_t highMv);
+    void setCalibration(uint8_t channel, const UM_ADS1015Calibration &cal);
+    UM_ADS1015Calibration getCalibration(uint8_t channel) { return m_cal[channel & (ADS1015_CHANNELS - 1)]; }
+    void clearCalibration();
+    // kept in NVS, one entry per I2C address - begin() clears the calibration, so load it after
+    bool saveCalibration();
+    bool loadCalibration();
+
 private:
+    uint16_t singleEndedConfig(uint8_t channel);
+    uint16_t differentialConfig(uint8_t channel);
+    int16_t toSigned(uint16_t raw);
+    bool startAsync(uint16_t config, UM_I2CTransfer &xfer);
+    void updateScale();
+
+    UM_I2CBus *m_bus = &I2CBus0;
+    UM_I2CDevice *m_dev = NULL;
     uint8_t m_i2cAddress;
     uint8_t m_conversionDelay;
     uint8_t m_bitShift;
     adsGain_t m_gain;
+
+    UM_ADS1015Calibration m_cal[ADS1015_CHANNELS];
+    int32_t m_mvMul[ADS1015_CHANNELS];    // Q16 mV per count, calibration included
+    int32_t m_mvOffset[ADS1015_CHANNELS]; // Q16 mV
+    int32_t m_uvMul[ADS1015_CHANNELS];    // Q16 uV per count, calibration included
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,55 @@
+#ifndef _UM_EVENTQUEUE_H_
+#define _UM_EVENTQUEUE_H_
+
+#include <Arduino.h>
+
+// Fixed capacity single producer / single consumer queue
+// Safe to push from an ISR and pop from the main loop without disabling interrupts, as long as
+// there is only ever one of each. The producer only writes m_head and the consumer only writes m_tail.
+// Size must be a power of 2 and one slot is always kept free to tell full from empty.
+template <typename T, uint16_t Size>
+class UM_EventQueue
+{
+    static_assert((Size & (Size - 1)) == 0, "UM_EventQueue size must be a power of 2");
+
+public:
+    // returns false and counts an overrun if the queue is full
+    inline bool IRAM_ATTR push(const T &item)
+    {
+        uint16_t head = m_head;
+        uint16_t next = (head + 1) & (Size - 1);
+        if (next == __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE))
+        {
+            m_overruns++;
+            return false;
+        }
+        m_items[head] = item;
+        __atomic_store_n(&m_head, next, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    inline bool pop(T &item)
+    {
+        uint16_t tail = m_tail;
+        if (tail == __atomic_load_n(&m_head, __ATOMIC_ACQUIRE))
+            return false;
+        item = m_items[tail];
+        __atomic_store_n(&m_tail, (uint16_t)((tail + 1) & (Size - 1)), __ATOMIC_RELEASE);
+        return true;
+    }
+
+    bool empty() { return __atomic_load_n(&m_head, __ATOMIC_ACQUIRE) == m_tail; }
+    uint16_t count() { return (__atomic_load_n(&m_head, __ATOMIC_ACQUIRE) - m_tail) & (Size - 1); }
+    uint16_t capacity() { return Size - 1; }
+
+    // overruns are only ever incremented by the producer
+    uint32_t overruns() { return m_overruns; }
+
+private:
+    T m_items[Size];
+    volatile uint16_t m_head = 0;
+    volatile uint16_t m_tail = 0;
+    volatile uint32_t m_overruns = 0;
+};
+
+#endif
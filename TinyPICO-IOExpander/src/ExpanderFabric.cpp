@@ -0,0 +1,218 @@
+#include "ExpanderFabric.h"
+
+uint8_t UM_ExpanderFabric::begin()
+{
+    m_bus->begin();
+
+    for (uint8_t addr = MCP23017_ADDRESS; addr < MCP23017_ADDRESS + FABRIC_MAX_MCP; addr++)
+        if (m_bus->probe(addr))
+            addMCP(addr);
+
+    for (uint8_t addr = ADS1015_ADDRESS; addr < ADS1015_ADDRESS + FABRIC_MAX_ADS; addr++)
+        if (m_bus->probe(addr))
+            addADS(addr);
+
+    return m_numMcp + m_numAds;
+}
+
+int UM_ExpanderFabric::addMCP(uint8_t address)
+{
+    if (m_numMcp >= FABRIC_MAX_MCP)
+        return -1;
+
+    uint8_t device = m_numMcp;
+    m_mcp[device].begin(address, *m_bus);
+    m_ports[device] = m_mcp[device].readPorts();
+    m_latches[device] = m_mcp[device].readLatches();
+    m_numMcp++;
+
+    return device * FABRIC_PINS_PER_MCP;
+}
+
+int UM_ExpanderFabric::addADS(uint8_t address)
+{
+    if (m_numAds >= FABRIC_MAX_ADS)
+        return -1;
+
+    uint8_t device = m_numAds;
+    m_ads[device].begin(address, *m_bus);
+    m_adsMask[device] = 0x0F;
+    m_adsChannel[device] = -1;
+    for (int i = 0; i < FABRIC_CHANNELS_PER_ADS; i++)
+        m_analog[device * FABRIC_CHANNELS_PER_ADS + i] = 0;
+    m_numAds++;
+
+    return device * FABRIC_CHANNELS_PER_ADS;
+}
+
+void UM_ExpanderFabric::pinMode(uint16_t pin, uint8_t mode)
+{
+    uint8_t device = pin / FABRIC_PINS_PER_MCP;
+    if (device < m_numMcp)
+        m_mcp[device].pinMode(pin % FABRIC_PINS_PER_MCP, mode);
+}
+
+void UM_ExpanderFabric::pullUp(uint16_t pin, uint8_t d)
+{
+    uint8_t device = pin / FABRIC_PINS_PER_MCP;
+    if (device < m_numMcp)
+        m_mcp[device].pullUp(pin % FABRIC_PINS_PER_MCP, d);
+}
+
+void UM_ExpanderFabric::digitalWrite(uint16_t pin, uint8_t value)
+{
+    uint8_t device = pin / FABRIC_PINS_PER_MCP;
+    if (device >= m_numMcp)
+        return;
+
+    uint16_t latches = m_latches[device];
+    bitWrite(latches, pin % FABRIC_PINS_PER_MCP, value);
+    if (latches != m_latches[device])
+    {
+        m_latches[device] = latches;
+        m_dirtyLatches |= 1 << device;
+    }
+}
+
+void UM_ExpanderFabric::writePorts(uint8_t device, uint16_t value)
+{
+    if (device >= m_numMcp || value == m_latches[device])
+        return;
+
+    m_latches[device] = value;
+    m_dirtyLatches |= 1 << device;
+}
+
+uint8_t UM_ExpanderFabric::digitalRead(uint16_t pin)
+{
+    uint8_t device = pin / FABRIC_PINS_PER_MCP;
+    if (device >= m_numMcp)
+        return 0;
+    return (m_ports[device] >> (pin % FABRIC_PINS_PER_MCP)) & 0x1;
+}
+
+int16_t UM_ExpanderFabric::analogRead(uint8_t channel)
+{
+    if (channel >= channelCount())
+        return 0;
+    return m_analog[channel];
+}
+
+int32_t UM_ExpanderFabric::analogReadMilliVolts(uint8_t channel)
+{
+    if (channel >= channelCount())
+        return 0;
+    return m_ads[channel / FABRIC_CHANNELS_PER_ADS].toMilliVolts(m_analog[channel], channel % FABRIC_CHANNELS_PER_ADS);
+}
+
+void UM_ExpanderFabric::setAnalogChannels(uint8_t device, uint8_t channelMask)
+{
+    if (device < m_numAds)
+        m_adsMask[device] = channelMask & 0x0F;
+}
+
+void UM_ExpanderFabric::analogSetGain(uint8_t device, adsGain_t gain)
+{
+    if (device < m_numAds)
+        m_ads[device].analogSetGain(gain);
+}
+
+void UM_ExpanderFabric::flush()
+{
+    if (!m_dirtyLatches || !m_bus->lock(NULL))
+        return;
+
+    flushLocked();
+    m_bus->unlock(NULL);
+}
+
+void UM_ExpanderFabric::flushLocked()
+{
+    uint8_t failed = 0;
+    while (m_dirtyLatches)
+    {
+        uint8_t device = __builtin_ctz(m_dirtyLatches);
+        m_dirtyLatches &= m_dirtyLatches - 1;
+        if (!m_mcp[device].writePorts(m_latches[device]))
+            failed |= 1 << device;
+    }
+
+    // leave failed writes dirty, so the next scan() or flush() tries them again
+    m_dirtyLatches |= failed;
+}
+
+void UM_ExpanderFabric::scanAnalog(uint8_t device, uint32_t now)
+{
+    uint8_t mask = m_adsMask[device];
+    int8_t channel = m_adsChannel[device];
+
+    if (channel >= 0)
+    {
+        // not finished yet, try again next scan
+        if (now - m_adsStarted[device] < m_ads[device].conversionDelay() * 1000UL)
+            return;
+        int16_t value = m_ads[device].readConversion();
+        if (m_ads[device].lastError() == I2C_RESULT_OK)
+            m_analog[device * FABRIC_CHANNELS_PER_ADS + channel] = value;
+    }
+
+    if (!mask)
+    {
+        m_adsChannel[device] = -1;
+        return;
+    }
+
+    // next enabled channel after this one
+    do
+    {
+        channel = (channel + 1) % FABRIC_CHANNELS_PER_ADS;
+    } while (!(mask & (1 << channel)));
+
+    if (m_ads[device].startSingleEnded(channel))
+    {
+        m_adsChannel[device] = channel;
+        m_adsStarted[device] = now;
+    }
+    else
+    {
+        m_adsChannel[device] = -1;
+    }
+}
+
+uint8_t UM_ExpanderFabric::scan()
+{
+    uint16_t changed[FABRIC_MAX_MCP];
+    uint8_t changedMask = 0;
+
+    if (!m_bus->lock(NULL))
+        return 0;
+
+    // outputs first, so this scan reads back what we just wrote
+    flushLocked();
+
+    for (uint8_t i = 0; i < m_numMcp; i++)
+    {
+        uint16_t ports = m_mcp[i].readPorts();
+        // keep the last good state rather than reporting a failed read as every pin low
+        if (m_mcp[i].lastError() != I2C_RESULT_OK)
+            ports = m_ports[i];
+        changed[i] = ports ^ m_ports[i];
+        m_ports[i] = ports;
+        if (changed[i])
+            changedMask |= 1 << i;
+    }
+
+    uint32_t now = micros();
+    for (uint8_t i = 0; i < m_numAds; i++)
+        scanAnalog(i, now);
+
+    m_bus->unlock(NULL);
+
+    // callbacks run with the bus released
+    if (m_changeFn)
+        for (uint8_t i = 0; i < m_numMcp; i++)
+            if (changedMask & (1 << i))
+                m_changeFn(m_changeContext, i, m_ports[i], changed[i]);
+
+    return changedMask;
+}
@@ -0,0 +1,99 @@
+#ifndef _UM_EXPANDERFABRIC_H_
+#define _UM_EXPANDERFABRIC_H_
+
+#include <Arduino.h>
+#include "MCP23017.h"
+#include "ADS1015.h"
+#include "I2CBus.h"
+
+// The A0-A2 address pins give 8 MCP23017s (0x20-0x27) and the ADDR pin 4 ADS1015s (0x48-0x4B) per bus
+#define FABRIC_MAX_MCP 8
+#define FABRIC_MAX_ADS 4
+#define FABRIC_PINS_PER_MCP 16
+#define FABRIC_CHANNELS_PER_ADS 4
+
+// Multi device expander fabric
+// Stacks of expanders share one virtual numbering. Pin n lives on MCP n / 16, channel n on ADS n / 4,
+// in the order the devices were added (address order when begin() finds them).
+//
+// scan() does one pass over every device with the bus held: pending output writes go out as one
+// burst per MCP, both input ports of each MCP are read in one burst, and each ADS collects its last
+// conversion and starts the next one. Reads and writes between scans work on the cached state, so
+// nothing here waits on the ADC.
+class UM_ExpanderFabric
+{
+public:
+    UM_ExpanderFabric(UM_I2CBus &bus = I2CBus0) : m_bus(&bus) {}
+
+    // probe the whole address range and add everything that answers, returns the number of devices found
+    uint8_t begin();
+
+    // add a device at a known address, returns its first virtual pin / channel, or -1
+    int addMCP(uint8_t address);
+    int addADS(uint8_t address);
+
+    uint8_t mcpCount() { return m_numMcp; }
+    uint8_t adsCount() { return m_numAds; }
+    uint16_t pinCount() { return m_numMcp * FABRIC_PINS_PER_MCP; }
+    uint8_t channelCount() { return m_numAds * FABRIC_CHANNELS_PER_ADS; }
+
+    // direct access to a device driver, for anything the fabric doesn't cover
+    UM_MCP23017 &mcp(uint8_t device) { return m_mcp[device]; }
+    UM_ADS1015 &ads(uint8_t device) { return m_ads[device]; }
+
+    // digital - configuration is written straight away
+    void pinMode(uint16_t pin, uint8_t mode);
+    void pullUp(uint16_t pin, uint8_t d);
+    // outputs are latched locally and written by the next scan() or flush()
+    void digitalWrite(uint16_t pin, uint8_t value);
+    // inputs are as of the last scan()
+    uint8_t digitalRead(uint16_t pin);
+    uint16_t readPorts(uint8_t device) { return device < m_numMcp ? m_ports[device] : 0; }
+    void writePorts(uint8_t device, uint16_t value);
+
+    // analog - values are as of the last scan() that completed a conversion on that channel
+    int16_t analogRead(uint8_t channel);
+    // the same reading, scaled and calibrated by its ADS1015 (see UM_ADS1015::toMilliVolts)
+    int32_t analogReadMilliVolts(uint8_t channel);
+    // which channels (bit mask) each ADS cycles through, all 4 by default
+    void setAnalogChannels(uint8_t device, uint8_t channelMask);
+    void analogSetGain(uint8_t device, adsGain_t gain);
+
+    // called from scan() once per MCP whose inputs changed
+    typedef void (*fabricCBFn)(void *context, uint8_t device, uint16_t ports, uint16_t changed);
+    bool RegisterChangeCB(fabricCBFn fn, void *context)
+    {
+        m_changeFn = fn;
+        m_changeContext = context;
+        return true;
+    }
+
+    // returns a bit mask of the MCPs whose inputs changed
+    uint8_t scan();
+    // write any pending outputs without scanning
+    void flush();
+
+private:
+    void flushLocked();
+    void scanAnalog(uint8_t device, uint32_t now);
+
+    UM_I2CBus *m_bus;
+
+    UM_MCP23017 m_mcp[FABRIC_MAX_MCP];
+    uint16_t m_ports[FABRIC_MAX_MCP];
+    uint16_t m_latches[FABRIC_MAX_MCP];
+    uint8_t m_dirtyLatches = 0;
+    uint8_t m_numMcp = 0;
+
+    UM_ADS1015 m_ads[FABRIC_MAX_ADS];
+    int16_t m_analog[FABRIC_MAX_ADS * FABRIC_CHANNELS_PER_ADS];
+    uint8_t m_adsMask[FABRIC_MAX_ADS];
+    int8_t m_adsChannel[FABRIC_MAX_ADS]; // channel being converted, -1 if none
+    uint32_t m_adsStarted[FABRIC_MAX_ADS];
+    uint8_t m_numAds = 0;
+
+    fabricCBFn m_changeFn = NULL;
+    void *m_changeContext = NULL;
+};
+
+#endif
@@ -0,0 +1,593 @@
+#include "I2CBus.h"
+
+UM_I2CBus I2CBus0(Wire);
+
+UM_I2CBus::UM_I2CBus(TwoWire &wire) : m_wire(wire)
+{
+}
+
+bool UM_I2CBus::begin(int sda, int scl, uint32_t frequency)
+{
+    if (m_mutex == NULL)
+        m_mutex = xSemaphoreCreateRecursiveMutex();
+
+    if (m_started)
+        return true;
+
+    // remember the pins for bus recovery
+    if (sda >= 0)
+        m_sda = sda;
+    if (scl >= 0)
+        m_scl = scl;
+    m_frequency = frequency;
+
+    m_started = m_wire.begin(m_sda, m_scl, m_frequency);
+    return m_started;
+}
+
+UM_I2CDevice *UM_I2CBus::addDevice(uint8_t address, i2cPriority_t priority, const char *name)
+{
+    // a driver that is begun twice keeps its existing slot
+    UM_I2CDevice *dev = getDevice(address);
+    if (dev != NULL)
+    {
+        dev->priority = priority;
+        return dev;
+    }
+
+    if (m_numDevices >= I2CBUS_MAX_DEVICES)
+        return NULL;
+
+    dev = &m_devices[m_numDevices++];
+    dev->address = address;
+    dev->priority = priority;
+    dev->name = name;
+    memset(&dev->stats, 0, sizeof(dev->stats));
+    dev->lastResult = I2C_RESULT_OK;
+    return dev;
+}
+
+UM_I2CDevice *UM_I2CBus::getDevice(uint8_t address)
+{
+    for (int i = 0; i < m_numDevices; i++)
+        if (m_devices[i].address == address)
+            return &m_devices[i];
+    return NULL;
+}
+
+bool UM_I2CBus::probe(uint8_t address)
+{
+    if (!lock(NULL))
+        return false;
+
+    m_wire.beginTransmission(address);
+    bool ok = m_wire.endTransmission() == 0;
+
+    unlock(NULL);
+    return ok;
+}
+
+bool UM_I2CBus::lock(UM_I2CDevice *dev, TickType_t timeout)
+{
+    if (m_mutex == NULL)
+        begin();
+
+    // already ours, just nest
+    if (m_depth > 0 && xSemaphoreGetMutexHolder(m_mutex) == xTaskGetCurrentTaskHandle())
+    {
+        xSemaphoreTakeRecursive(m_mutex, 0);
+        m_depth++;
+        return true;
+    }
+
+    uint32_t start = micros();
+    bool urgent = dev && dev->priority == I2C_PRIORITY_LOW_LATENCY;
+
+    if (urgent)
+    {
+        __atomic_add_fetch(&m_urgentWaiting, 1, __ATOMIC_SEQ_CST);
+        bool taken = xSemaphoreTakeRecursive(m_mutex, timeout) == pdTRUE;
+        __atomic_sub_fetch(&m_urgentWaiting, 1, __ATOMIC_SEQ_CST);
+        if (!taken)
+            return false;
+    }
+    else
+    {
+        // Step aside at every handoff while a low latency device is waiting. The timeout covers the
+        // whole wait, so each take only gets what is left of it.
+        TickType_t entered = xTaskGetTickCount();
+        while (true)
+        {
+            TickType_t remaining = portMAX_DELAY;
+            if (timeout != portMAX_DELAY)
+            {
+                TickType_t waited = xTaskGetTickCount() - entered;
+                remaining = waited < timeout ? timeout - waited : 0;
+            }
+
+            if (xSemaphoreTakeRecursive(m_mutex, remaining) != pdTRUE)
+                return false;
+            if (m_urgentWaiting == 0)
+                break;
+            xSemaphoreGiveRecursive(m_mutex);
+            if (remaining == 0)
+                return false;
+            vTaskDelay(1);
+        }
+    }
+
+    m_owner = dev;
+    m_depth = 1;
+    m_lockTime = micros();
+
+    if (dev)
+    {
+        dev->stats.locks++;
+        uint32_t wait = m_lockTime - start;
+        dev->stats.waitTotal += wait;
+        if (wait > dev->stats.waitMax)
+            dev->stats.waitMax = wait;
+    }
+
+    return true;
+}
+
+void UM_I2CBus::unlock(UM_I2CDevice *dev)
+{
+    if (m_depth == 0)
+        return;
+
+    if (--m_depth == 0)
+    {
+        if (m_owner)
+        {
+            uint32_t hold = micros() - m_lockTime;
+            m_owner->stats.holdTotal += hold;
+            if (hold > m_owner->stats.holdMax)
+                m_owner->stats.holdMax = hold;
+        }
+        m_owner = NULL;
+    }
+
+    xSemaphoreGiveRecursive(m_mutex);
+}
+
+bool UM_I2CBus::write(UM_I2CDevice *dev, const uint8_t *data, size_t len)
+{
+    return transfer(dev, data, len, NULL, 0) == I2C_RESULT_OK;
+}
+
+bool UM_I2CBus::writeRead(UM_I2CDevice *dev, const uint8_t *tx, size_t txLen, uint8_t *rx, size_t rxLen)
+{
+    return transfer(dev, tx, txLen, rx, rxLen) == I2C_RESULT_OK;
+}
+
+i2cResult_t UM_I2CBus::transfer(UM_I2CDevice *dev, const uint8_t *tx, size_t txLen, uint8_t *rx, size_t rxLen)
+{
+    if (dev == NULL)
+        return I2C_RESULT_BUSY;
+
+    uint32_t start = traceStart();
+    i2cResult_t result;
+    for (uint8_t attempt = 0;; attempt++)
+    {
+        if (!lock(dev, m_lockTimeout))
+        {
+            // nothing went on the wire, so retrying would just wait all over again
+            result = I2C_RESULT_BUSY;
+            dev->stats.errors++;
+            break;
+        }
+
+        result = transferOnce(dev, tx, txLen, rx, rxLen);
+        // A read that fails part way through can leave a device driving SDA, whatever Wire reports
+        if ((result == I2C_RESULT_TIMEOUT || result == I2C_RESULT_OTHER || result == I2C_RESULT_SHORT_READ) && busStuck())
+        {
+            if (!recover())
+                result = I2C_RESULT_BUS_STUCK;
+        }
+        unlock(dev);
+
+        if (result == I2C_RESULT_OK || result == I2C_RESULT_TOO_LONG || attempt >= m_retries)
+            break;
+
+        // back off with the bus released, so whoever is waiting gets a turn
+        dev->stats.retries++;
+        uint32_t backoff = (uint32_t)m_backoffUs << attempt;
+        if (backoff >= 1000 * portTICK_PERIOD_MS)
+            vTaskDelay(backoff / 1000 / portTICK_PERIOD_MS);
+        else
+            delayMicroseconds(backoff);
+    }
+
+    trace(dev, tx, txLen, rxLen, result, start);
+    dev->lastResult = result;
+    return result;
+}
+
+// called with the bus held
+i2cResult_t UM_I2CBus::transferOnce(UM_I2CDevice *dev, const uint8_t *tx, size_t txLen, uint8_t *rx, size_t rxLen)
+{
+    m_wire.beginTransmission(dev->address);
+    m_wire.write(tx, txLen);
+    uint8_t code = m_wire.endTransmission(rxLen == 0);
+    i2cResult_t result = code < I2C_RESULT_SHORT_READ ? (i2cResult_t)code : I2C_RESULT_OTHER;
+    if (result == I2C_RESULT_OK && rxLen > 0)
+    {
+        uint32_t readStart = micros();
+        uint8_t got = m_wire.requestFrom(dev->address, (uint8_t)rxLen);
+        if (got < rxLen)
+            result = readError(got, micros() - readStart);
+        else
+            for (size_t i = 0; i < rxLen; i++)
+                rx[i] = m_wire.read();
+    }
+    dev->stats.transactions++;
+    if (result != I2C_RESULT_OK)
+        dev->stats.errors++;
+
+    return result;
+}
+
+// On arduino-esp32 2.x a repeated start endTransmission() only queues the write, and the whole
+// transaction runs in requestFrom(). Its Wire has no lastError(), and a failure of any kind returns
+// no bytes at all, so the only other clue is how long it took.
+i2cResult_t UM_I2CBus::readError(uint8_t got, uint32_t elapsedUs)
+{
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 2
+    if (got > 0)
+        return I2C_RESULT_SHORT_READ;
+    if (elapsedUs >= (uint32_t)m_wire.getTimeOut() * 1000)
+        return I2C_RESULT_TIMEOUT;
+    // failed straight away - usually a NACK, but it could be lost arbitration, so let transfer() check the bus
+    return I2C_RESULT_OTHER;
+#else
+    (void)got;
+    (void)elapsedUs;
+    switch (m_wire.lastError())
+    {
+    case I2C_ERROR_OK:
+        return I2C_RESULT_SHORT_READ;
+    case I2C_ERROR_ACK:
+        return I2C_RESULT_ADDR_NACK;
+    case I2C_ERROR_TIMEOUT:
+        return I2C_RESULT_TIMEOUT;
+    default:
+        return I2C_RESULT_OTHER;
+    }
+#endif
+}
+
+void UM_I2CBus::setTimeouts(uint16_t transactionMs, TickType_t lockTicks)
+{
+    m_wire.setTimeOut(transactionMs);
+    m_lockTimeout = lockTicks;
+}
+
+void UM_I2CBus::setRetries(uint8_t retries, uint16_t backoffUs)
+{
+    m_retries = retries;
+    m_backoffUs = backoffUs;
+}
+
+bool UM_I2CBus::busStuck()
+{
+    return ::digitalRead(m_sda) == LOW || ::digitalRead(m_scl) == LOW;
+}
+
+bool UM_I2CBus::recover()
+{
+    if (!lock(NULL, m_lockTimeout))
+        return false;
+
+    m_recoveries++;
+    m_wire.end();
+
+    // Drive SCL by hand. Whatever is holding SDA is part way through sending a byte, and lets go
+    // once it has been clocked out, within 9 clocks.
+    pinMode(m_sda, INPUT_PULLUP);
+    pinMode(m_scl, OUTPUT_OPEN_DRAIN);
+    ::digitalWrite(m_scl, HIGH);
+    delayMicroseconds(5);
+
+    for (int i = 0; i < 9 && ::digitalRead(m_sda) == LOW; i++)
+    {
+        ::digitalWrite(m_scl, LOW);
+        delayMicroseconds(5);
+        ::digitalWrite(m_scl, HIGH);
+        delayMicroseconds(5);
+    }
+
+    // STOP - SDA goes low to high while SCL is high
+    ::digitalWrite(m_scl, LOW);
+    pinMode(m_sda, OUTPUT_OPEN_DRAIN);
+    ::digitalWrite(m_sda, LOW);
+    delayMicroseconds(5);
+    ::digitalWrite(m_scl, HIGH);
+    delayMicroseconds(5);
+    ::digitalWrite(m_sda, HIGH);
+    delayMicroseconds(5);
+
+    pinMode(m_sda, INPUT_PULLUP);
+    pinMode(m_scl, INPUT_PULLUP);
+    bool freed = ::digitalRead(m_sda) == HIGH && ::digitalRead(m_scl) == HIGH;
+
+    m_wire.begin(m_sda, m_scl, m_frequency);
+
+    unlock(NULL);
+    return freed;
+}
+
+void UM_I2CTransfer::set(UM_I2CDevice *d, const uint8_t *data, uint8_t len, uint32_t us, uint8_t reg, uint8_t readLen)
+{
+    dev = d;
+    txLen = min(len, (uint8_t)I2C_TRANSFER_MAX_TX);
+    memcpy(tx, data, txLen);
+    waitUs = us;
+    readReg = reg;
+    rxLen = min(readLen, (uint8_t)I2C_TRANSFER_MAX_RX);
+}
+
+void UM_I2CTransfer::complete(uint8_t code)
+{
+    result = code;
+
+    // Once it's marked done the owner is free to reuse or destroy it, so everything we still
+    // need is read first. A waiter that registers after this is covered by the tick timeout in wait().
+    TaskHandle_t waiter = __atomic_load_n(&m_waiter, __ATOMIC_SEQ_CST);
+    if (m_fn)
+        m_fn(m_context, *this);
+
+    __atomic_store_n(&m_state, (uint8_t)I2C_TRANSFER_DONE, __ATOMIC_SEQ_CST);
+    if (waiter)
+        xTaskNotifyGive(waiter);
+}
+
+bool UM_I2CTransfer::wait(TickType_t timeout)
+{
+    __atomic_store_n(&m_waiter, xTaskGetCurrentTaskHandle(), __ATOMIC_SEQ_CST);
+
+    TickType_t start = xTaskGetTickCount();
+    while (!done())
+    {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (timeout != portMAX_DELAY && waited >= timeout)
+            break;
+        ulTaskNotifyTake(pdTRUE, 1);
+    }
+
+    __atomic_store_n(&m_waiter, (TaskHandle_t)NULL, __ATOMIC_SEQ_CST);
+    return done();
+}
+
+bool UM_I2CBus::beginAsync(UBaseType_t priority, BaseType_t core, uint8_t queueDepth)
+{
+    if (m_asyncTask != NULL)
+        return true;
+
+    begin();
+    m_asyncQueue = xQueueCreate(queueDepth, sizeof(UM_I2CTransfer *));
+    if (m_asyncQueue == NULL)
+        return false;
+
+    return xTaskCreatePinnedToCore(asyncTask, "i2cbus", 3072, this, priority, &m_asyncTask, core) == pdPASS;
+}
+
+bool UM_I2CBus::submit(UM_I2CTransfer &xfer)
+{
+    if (xfer.busy() || xfer.dev == NULL)
+        return false;
+
+    xfer.m_state = I2C_TRANSFER_QUEUED;
+    xfer.result = I2C_RESULT_BUSY;
+
+    if (m_asyncQueue == NULL)
+    {
+        // no worker, do it now
+        if (xfer.waitUs == 0)
+        {
+            xfer.complete(transfer(xfer.dev, xfer.tx, xfer.txLen, xfer.rx, xfer.rxLen));
+        }
+        else
+        {
+            i2cResult_t result = transfer(xfer.dev, xfer.tx, xfer.txLen, NULL, 0);
+            if (result != I2C_RESULT_OK)
+            {
+                xfer.complete(result);
+                return true;
+            }
+            delayMicroseconds(xfer.waitUs);
+            runWaitedRead(xfer);
+        }
+        return true;
+    }
+
+    UM_I2CTransfer *p = &xfer;
+    if (xQueueSend(m_asyncQueue, &p, 0) != pdTRUE)
+    {
+        xfer.m_state = I2C_TRANSFER_IDLE;
+        return false;
+    }
+    return true;
+}
+
+void UM_I2CBus::runWaitedRead(UM_I2CTransfer &xfer)
+{
+    if (xfer.rxLen == 0)
+        xfer.complete(I2C_RESULT_OK);
+    else
+        xfer.complete(transfer(xfer.dev, &xfer.readReg, 1, xfer.rx, xfer.rxLen));
+}
+
+void UM_I2CBus::asyncTask(void *arg)
+{
+    ((UM_I2CBus *)arg)->asyncLoop();
+}
+
+void UM_I2CBus::asyncLoop()
+{
+    UM_I2CTransfer *waiting[I2CBUS_ASYNC_MAX_WAITING];
+    uint8_t numWaiting = 0;
+
+    while (true)
+    {
+        // finish anything whose wait is over
+        uint32_t now = micros();
+        TickType_t timeout = portMAX_DELAY;
+        for (uint8_t i = 0; i < numWaiting;)
+        {
+            int32_t remaining = (int32_t)(waiting[i]->m_due - now);
+            if (remaining <= 0)
+            {
+                runWaitedRead(*waiting[i]);
+                waiting[i] = waiting[--numWaiting];
+                continue;
+            }
+
+            // round up, so we never wake early
+            TickType_t ticks = (remaining / 1000 + portTICK_PERIOD_MS) / portTICK_PERIOD_MS;
+            if (ticks < timeout)
+                timeout = ticks;
+            i++;
+        }
+
+        // no room to start another wait, so just sleep until the next one is due
+        if (numWaiting >= I2CBUS_ASYNC_MAX_WAITING)
+        {
+            vTaskDelay(timeout);
+            continue;
+        }
+
+        UM_I2CTransfer *xfer;
+        if (xQueueReceive(m_asyncQueue, &xfer, timeout) != pdTRUE)
+            continue;
+
+        if (xfer->waitUs == 0)
+        {
+            xfer->complete(transfer(xfer->dev, xfer->tx, xfer->txLen, xfer->rx, xfer->rxLen));
+            continue;
+        }
+
+        i2cResult_t result = transfer(xfer->dev, xfer->tx, xfer->txLen, NULL, 0);
+        if (result != I2C_RESULT_OK)
+        {
+            xfer->complete(result);
+            continue;
+        }
+
+        xfer->m_due = micros() + xfer->waitUs;
+        xfer->m_state = I2C_TRANSFER_WAITING;
+        waiting[numWaiting++] = xfer;
+    }
+}
+
+void UM_I2CBus::resetStats()
+{
+    for (int i = 0; i < m_numDevices; i++)
+        memset(&m_devices[i].stats, 0, sizeof(UM_I2CStats));
+}
+
+void UM_I2CBus::printStats(Print &out)
+{
+    out.printf("%-10s %4s %4s %8s %6s %7s %8s %8s %8s %8s\r\n", "Device", "Addr", "Prio", "Trans", "Errors", "Retries", "WaitAvg", "WaitMax", "HoldAvg", "HoldMax");
+    for (int i = 0; i < m_numDevices; i++)
+    {
+        UM_I2CDevice &d = m_devices[i];
+        uint32_t n = d.stats.locks > 0 ? d.stats.locks : 1;
+        out.printf("%-10s 0x%02X %4d %8u %6u %7u %8u %8u %8u %8u\r\n", d.name, d.address, d.priority,
+                   d.stats.transactions, d.stats.errors, d.stats.retries,
+                   (uint32_t)(d.stats.waitTotal / n), d.stats.waitMax,
+                   (uint32_t)(d.stats.holdTotal / n), d.stats.holdMax);
+    }
+    out.printf("Bus recoveries: %u\r\n", m_recoveries);
+}
+
+#if TPIO_I2C_TRACE
+
+void UM_I2CBus::trace(const UM_I2CDevice *dev, const uint8_t *tx, size_t txLen, size_t rxLen, uint8_t result, uint32_t start)
+{
+    uint32_t cycles = ESP.getCycleCount() - start;
+
+    portENTER_CRITICAL(&m_traceMux);
+    UM_I2CTraceEntry &e = m_trace[m_traceHead & (TPIO_I2C_TRACE_SIZE - 1)];
+    e.start = start;
+    e.cycles = cycles;
+    e.address = dev->address;
+    e.reg = txLen > 0 ? tx[0] : 0;
+    e.txLen = txLen;
+    e.rxLen = rxLen;
+    e.result = result;
+    m_traceHead++;
+
+    UM_I2CTraceCounters &c = m_traceCounters;
+    c.transactions++;
+    c.results[result < I2C_RESULT_CODES ? result : 4]++;
+    c.cyclesTotal += cycles;
+    if (cycles > c.cyclesMax)
+    {
+        c.cyclesMax = cycles;
+        c.slowestAddress = e.address;
+        c.slowestReg = e.reg;
+    }
+    portEXIT_CRITICAL(&m_traceMux);
+}
+
+size_t UM_I2CBus::traceCopy(UM_I2CTraceEntry *dest, size_t max)
+{
+    portENTER_CRITICAL(&m_traceMux);
+    uint32_t available = min(m_traceHead, (uint32_t)TPIO_I2C_TRACE_SIZE);
+    size_t count = min((size_t)available, max);
+    uint32_t first = m_traceHead - count;
+    for (size_t i = 0; i < count; i++)
+        dest[i] = m_trace[(first + i) & (TPIO_I2C_TRACE_SIZE - 1)];
+    portEXIT_CRITICAL(&m_traceMux);
+
+    return count;
+}
+
+void UM_I2CBus::traceDump(Print &out)
+{
+    // copy out first so we aren't printing from a critical section
+    static UM_I2CTraceEntry entries[TPIO_I2C_TRACE_SIZE];
+    size_t count = traceCopy(entries, TPIO_I2C_TRACE_SIZE);
+    UM_I2CTraceCounters c = traceCounters();
+    uint32_t mhz = ESP.getCpuFreqMHz();
+
+    out.printf("%4s %4s %4s %3s %3s %6s %8s\r\n", "#", "Addr", "Reg", "Tx", "Rx", "Result", "us");
+    for (size_t i = 0; i < count; i++)
+    {
+        UM_I2CTraceEntry &e = entries[i];
+        out.printf("%4u 0x%02X 0x%02X %3u %3u %6u %8u\r\n", (unsigned)i, e.address, e.reg, e.txLen, e.rxLen, e.result, e.cycles / mhz);
+    }
+
+    uint32_t n = c.transactions > 0 ? c.transactions : 1;
+    out.printf("Transactions: %u  Avg: %uus  Max: %uus (0x%02X reg 0x%02X)\r\n", c.transactions,
+               (uint32_t)(c.cyclesTotal / n / mhz), c.cyclesMax / mhz, c.slowestAddress, c.slowestReg);
+    out.printf("Results: OK %u  Too long %u  Addr NACK %u  Data NACK %u  Other %u  Timeout %u  Short read %u  Busy %u  Stuck %u\r\n",
+               c.results[0], c.results[1], c.results[2], c.results[3], c.results[4], c.results[5], c.results[6], c.results[7], c.results[8]);
+}
+
+void UM_I2CBus::traceClear()
+{
+    portENTER_CRITICAL(&m_traceMux);
+    m_traceHead = 0;
+    memset(&m_traceCounters, 0, sizeof(m_traceCounters));
+    portEXIT_CRITICAL(&m_traceMux);
+}
+
+UM_I2CTraceCounters UM_I2CBus::traceCounters()
+{
+    portENTER_CRITICAL(&m_traceMux);
+    UM_I2CTraceCounters c = m_traceCounters;
+    portEXIT_CRITICAL(&m_traceMux);
+    return c;
+}
+
+#else
+
+size_t UM_I2CBus::traceCopy(UM_I2CTraceEntry *dest, size_t max) { return 0; }
+void UM_I2CBus::traceDump(Print &out) { out.println("I2C tracing is disabled, build with TPIO_I2C_TRACE=1"); }
+void UM_I2CBus::traceClear() {}
+UM_I2CTraceCounters UM_I2CBus::traceCounters() { return UM_I2CTraceCounters(); }
+
+#endif
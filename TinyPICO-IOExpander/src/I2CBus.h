@@ -0,0 +1,276 @@
+#ifndef _UM_I2CBUS_H_
+#define _UM_I2CBUS_H_
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+// room for a full expander fabric (8 MCP23017 + 4 ADS1015) plus the shield devices
+#define I2CBUS_MAX_DEVICES 16
+
+// Transaction tracing
+// Set TPIO_I2C_TRACE to 1 (e.g. -DTPIO_I2C_TRACE=1 in your build flags) to record every transfer
+// in a RAM ring buffer, with its final result after any retries - BUSY and BUS_STUCK included. With it at 0 the hooks are empty inlines and the buffer doesn't exist.
+#ifndef TPIO_I2C_TRACE
+#define TPIO_I2C_TRACE 0
+#endif
+
+// Number of transactions kept - must be a power of 2
+#ifndef TPIO_I2C_TRACE_SIZE
+#define TPIO_I2C_TRACE_SIZE 64
+#endif
+
+// Transaction results - the first 6 match the Wire endTransmission() codes
+typedef enum
+{
+    I2C_RESULT_OK = 0,
+    I2C_RESULT_TOO_LONG,   // more data than the Wire buffer holds
+    I2C_RESULT_ADDR_NACK,  // nothing answered at the address
+    I2C_RESULT_DATA_NACK,  // the device refused a byte
+    I2C_RESULT_OTHER,
+    I2C_RESULT_TIMEOUT,    // the transaction took longer than the Wire timeout
+    I2C_RESULT_SHORT_READ, // the device sent fewer bytes than we asked for
+    I2C_RESULT_BUSY,       // couldn't get the bus in time, nothing was sent
+    I2C_RESULT_BUS_STUCK,  // a device held SDA or SCL low and recovery didn't free it
+    I2C_RESULT_CODES
+} i2cResult_t;
+
+// Bus priority for a device. When the bus is contended, a waiting low latency device always gets it
+// before normal or bulk devices do, so a touch read or IRQ follow up isn't stuck behind a display flush.
+typedef enum
+{
+    I2C_PRIORITY_BULK = 0,
+    I2C_PRIORITY_NORMAL = 1,
+    I2C_PRIORITY_LOW_LATENCY = 2
+} i2cPriority_t;
+
+// Per device latency statistics, all times in microseconds
+struct UM_I2CStats
+{
+    uint32_t locks;
+    uint32_t transactions;
+    uint32_t errors;
+    uint32_t retries;
+    uint32_t waitMax;   // longest wait for the bus
+    uint64_t waitTotal;
+    uint32_t holdMax;   // longest time holding the bus
+    uint64_t holdTotal;
+};
+
+struct UM_I2CTraceEntry
+{
+    uint32_t start;  // CPU cycle count when the transfer was asked for
+    uint32_t cycles; // how long it took in CPU cycles, waiting for the bus and retries included
+    uint8_t address;
+    uint8_t reg;     // first byte written, the register for most devices
+    uint8_t txLen;
+    uint8_t rxLen;
+    uint8_t result;  // I2C_RESULT_x
+};
+
+struct UM_I2CTraceCounters
+{
+    uint32_t transactions;
+    uint32_t results[I2C_RESULT_CODES];
+    uint64_t cyclesTotal;
+    uint32_t cyclesMax;
+    uint8_t slowestAddress;
+    uint8_t slowestReg;
+};
+
+class UM_I2CDevice
+{
+public:
+    uint8_t address;
+    i2cPriority_t priority;
+    const char *name;
+    UM_I2CStats stats;
+    i2cResult_t lastResult; // of the most recent transfer, after any retries
+};
+
+// Asynchronous transfers
+#define I2C_TRANSFER_MAX_TX 4
+#define I2C_TRANSFER_MAX_RX 8
+// transfers that can sit in their wait phase at once
+#define I2CBUS_ASYNC_MAX_WAITING 8
+
+typedef enum
+{
+    I2C_TRANSFER_IDLE = 0,
+    I2C_TRANSFER_QUEUED,
+    I2C_TRANSFER_WAITING, // written, waiting out waitUs before the read
+    I2C_TRANSFER_DONE
+} i2cTransferState_t;
+
+// One transaction for the bus worker task. The caller owns it and it must stay put until done().
+// Without a wait it is a single write, or write then read. With a wait (an ADC conversion, say)
+// tx is written, the bus is released for waitUs, then readReg is written and rxLen bytes read.
+class UM_I2CTransfer
+{
+public:
+    typedef void (*doneFn)(void *context, UM_I2CTransfer &xfer);
+
+    void setWrite(UM_I2CDevice *d, const uint8_t *data, uint8_t len) { set(d, data, len, 0, 0, 0); }
+    void setWriteRead(UM_I2CDevice *d, const uint8_t *data, uint8_t len, uint8_t readLen) { set(d, data, len, 0, 0, readLen); }
+    void setWriteWaitRead(UM_I2CDevice *d, const uint8_t *data, uint8_t len, uint32_t us, uint8_t reg, uint8_t readLen) { set(d, data, len, us, reg, readLen); }
+    // called from the worker task when the transfer completes - keep it short
+    void onDone(doneFn fn, void *context)
+    {
+        m_fn = fn;
+        m_context = context;
+    }
+
+    bool done() const { return __atomic_load_n(&m_state, __ATOMIC_ACQUIRE) == I2C_TRANSFER_DONE; }
+    bool busy() const { return m_state == I2C_TRANSFER_QUEUED || m_state == I2C_TRANSFER_WAITING; }
+    // result is I2C_RESULT_BUSY until the transfer completes, so this is also safe from onDone()
+    bool ok() const { return result == I2C_RESULT_OK; }
+    // block the calling task until the transfer is done, false on timeout
+    bool wait(TickType_t timeout = portMAX_DELAY);
+
+    UM_I2CDevice *dev = NULL;
+    uint8_t tx[I2C_TRANSFER_MAX_TX];
+    uint8_t txLen = 0;
+    uint32_t waitUs = 0;
+    uint8_t readReg = 0;
+    uint8_t rx[I2C_TRANSFER_MAX_RX];
+    uint8_t rxLen = 0;
+    uint8_t result = I2C_RESULT_BUSY;
+
+private:
+    friend class UM_I2CBus;
+    void set(UM_I2CDevice *d, const uint8_t *data, uint8_t len, uint32_t us, uint8_t reg, uint8_t readLen);
+    void complete(uint8_t code);
+
+    volatile uint8_t m_state = I2C_TRANSFER_IDLE;
+    TaskHandle_t m_waiter = NULL;
+    uint32_t m_due = 0;
+    doneFn m_fn = NULL;
+    void *m_context = NULL;
+};
+
+class UM_I2CBus
+{
+public:
+    UM_I2CBus(TwoWire &wire);
+
+    // Safe to call more than once - only the first call starts the Wire peripheral
+    bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0);
+    TwoWire &wire() { return m_wire; }
+
+    // Devices are registered once and keep their slot for the life of the bus
+    UM_I2CDevice *addDevice(uint8_t address, i2cPriority_t priority, const char *name);
+    UM_I2CDevice *getDevice(uint8_t address);
+
+    // true if something acknowledges at this address
+    bool probe(uint8_t address);
+
+    // Exclusive access to the bus. Locks are recursive, so a driver can hold the bus across a
+    // read-modify-write while each of its reads and writes lock as well.
+    bool lock(UM_I2CDevice *dev, TickType_t timeout = portMAX_DELAY);
+    void unlock(UM_I2CDevice *dev);
+
+    // Transactions - each one locks the bus for its duration
+    bool write(UM_I2CDevice *dev, const uint8_t *data, size_t len);
+    bool writeRead(UM_I2CDevice *dev, const uint8_t *tx, size_t txLen, uint8_t *rx, size_t rxLen);
+    // as above, returning the result - rxLen of 0 is a plain write
+    i2cResult_t transfer(UM_I2CDevice *dev, const uint8_t *tx, size_t txLen, uint8_t *rx, size_t rxLen);
+
+    // Bounded latency
+    // Each transaction gives up after transactionMs, and waiting for the bus after lockTicks
+    // (portMAX_DELAY, the default, waits forever). Failed transactions are retried up to retries
+    // times, waiting backoffUs, then double that, and so on, between attempts with the bus released.
+    void setTimeouts(uint16_t transactionMs, TickType_t lockTicks = portMAX_DELAY);
+    void setRetries(uint8_t retries, uint16_t backoffUs = 100);
+
+    // Clock SCL up to 9 times to free a device holding SDA low, then send a STOP and restart Wire.
+    // This runs by itself when a transaction times out with the bus stuck.
+    bool recover();
+    uint32_t getRecoveries() { return m_recoveries; }
+
+    // Asynchronous transfers
+    // beginAsync() starts a worker task that runs submitted transfers in order, while the caller
+    // gets on with something else. Transfers in their wait phase don't hold up the ones behind them.
+    // Without the worker, submit() runs the transfer before returning.
+    bool beginAsync(UBaseType_t priority = 5, BaseType_t core = tskNO_AFFINITY, uint8_t queueDepth = 16);
+    bool submit(UM_I2CTransfer &xfer);
+
+    void resetStats();
+    void printStats(Print &out);
+
+    // Trace access - these still exist with tracing disabled, but report nothing
+    // copies up to max entries, oldest first, and returns how many were copied
+    size_t traceCopy(UM_I2CTraceEntry *dest, size_t max);
+    void traceDump(Print &out);
+    void traceClear();
+    UM_I2CTraceCounters traceCounters();
+
+private:
+#if TPIO_I2C_TRACE
+    static inline uint32_t traceStart() { return ESP.getCycleCount(); }
+    void trace(const UM_I2CDevice *dev, const uint8_t *tx, size_t txLen, size_t rxLen, uint8_t result, uint32_t start);
+
+    UM_I2CTraceEntry m_trace[TPIO_I2C_TRACE_SIZE];
+    uint32_t m_traceHead = 0; // total entries ever written, the ring index is the low bits
+    UM_I2CTraceCounters m_traceCounters = {};
+    portMUX_TYPE m_traceMux = portMUX_INITIALIZER_UNLOCKED; // a transfer that never got the bus is traced too
+#else
+    static inline uint32_t traceStart() { return 0; }
+    inline void trace(const UM_I2CDevice *, const uint8_t *, size_t, size_t, uint8_t, uint32_t) {}
+#endif
+
+    static void asyncTask(void *arg);
+    void asyncLoop();
+    void runWaitedRead(UM_I2CTransfer &xfer);
+    i2cResult_t transferOnce(UM_I2CDevice *dev, const uint8_t *tx, size_t txLen, uint8_t *rx, size_t rxLen);
+    i2cResult_t readError(uint8_t got, uint32_t elapsedUs);
+    bool busStuck();
+
+    TwoWire &m_wire;
+    SemaphoreHandle_t m_mutex = NULL;
+    QueueHandle_t m_asyncQueue = NULL;
+    TaskHandle_t m_asyncTask = NULL;
+    volatile uint16_t m_urgentWaiting = 0;
+    bool m_started = false;
+    int m_sda = SDA;
+    int m_scl = SCL;
+    uint32_t m_frequency = 0;
+
+    TickType_t m_lockTimeout = portMAX_DELAY;
+    uint8_t m_retries = 2;
+    uint16_t m_backoffUs = 100;
+    uint32_t m_recoveries = 0;
+
+    UM_I2CDevice m_devices[I2CBUS_MAX_DEVICES];
+    uint8_t m_numDevices = 0;
+
+    // only valid while the bus is held
+    UM_I2CDevice *m_owner = NULL;
+    uint8_t m_depth = 0;
+    uint32_t m_lockTime = 0;
+};
+
+// Default bus on Wire, used by the expander drivers unless they are given another one
+extern UM_I2CBus I2CBus0;
+
+// Hold the bus for the lifetime of the scope. Use this around third party drivers that talk to
+// Wire directly (displays, IMU, touch) so they are serialised with everything else.
+class UM_I2CLock
+{
+public:
+    UM_I2CLock(UM_I2CBus &bus, UM_I2CDevice *dev) : m_bus(bus), m_dev(dev) { m_locked = m_bus.lock(m_dev); }
+    ~UM_I2CLock()
+    {
+        if (m_locked)
+            m_bus.unlock(m_dev);
+    }
+
+private:
+    UM_I2CBus &m_bus;
+    UM_I2CDevice *m_dev;
+    bool m_locked;
+};
+
+#endif
@@ -1,48 +1,103 @@
 #include "MCP23017.h"
 
-void UM_MCP23017::begin(uint8_t addr)
+void UM_MCP23017::begin(uint8_t addr, UM_I2CBus &bus)
 {
     m_i2cAddress = addr;
+    m_bus = &bus;
 
-    Wire.begin(21, 22);
+    // the bus only starts Wire once, however many drivers share it
+    m_bus->begin();
+    m_dev = m_bus->addDevice(addr, I2C_PRIORITY_NORMAL, "MCP23017");
 
     // initialise ports
     write(MCP23017_IODIRA, 0xff);
     write(MCP23017_IODIRB, 0xff);
+
+    // nothing is pulled up yet, so start from idle rather than reading the floating pins
+    m_prevPorts = 0xFFFF;
+    m_debouncer.reset(m_prevPorts);
+}
+
+bool UM_MCP23017::snapshot(UM_MCP23017Snapshot &snap)
+{
+    uint8_t reg = MCP23017_IODIRA;
+
+    m_bus->lock(m_dev);
+    bool ok = m_bus->writeRead(m_dev, &reg, 1, snap.config, MCP23017_CONFIG_REGS);
+    reg = MCP23017_OLATA;
+    ok = ok && m_bus->writeRead(m_dev, &reg, 1, snap.latches, 2);
+    m_bus->unlock(m_dev);
+
+    snap.address = m_i2cAddress;
+    snap.valid = ok;
+    return ok;
+}
+
+bool UM_MCP23017::resume(const UM_MCP23017Snapshot &snap, UM_I2CBus &bus)
+{
+    if (!snap.valid)
+        return false;
+
+    m_i2cAddress = snap.address;
+    m_bus = &bus;
+    m_bus->begin();
+    m_dev = m_bus->addDevice(m_i2cAddress, I2C_PRIORITY_NORMAL, "MCP23017");
+
+    uint8_t reg = MCP23017_IODIRA;
+    uint8_t current[MCP23017_CONFIG_REGS];
+
+    m_bus->lock(m_dev);
+    bool ok = m_bus->writeRead(m_dev, &reg, 1, current, MCP23017_CONFIG_REGS);
+
+    // a chip that lost power comes back with every pin an input and nothing else set
+    if (ok && memcmp(current, snap.config, MCP23017_CONFIG_REGS) != 0)
+    {
+        // latches first, so pins that become outputs come up at their old level
+        ok = writePorts(((uint16_t)snap.latches[1] << 8) | snap.latches[0]);
+
+        // IOCON is part of the burst, which relies on it keeping BANK = 0 and SEQOP = 0 like the rest of the driver does
+        uint8_t buf[1 + MCP23017_CONFIG_REGS];
+        buf[0] = MCP23017_IODIRA;
+        memcpy(buf + 1, snap.config, MCP23017_CONFIG_REGS);
+        ok = ok && m_bus->write(m_dev, buf, sizeof(buf));
+    }
+
+    m_bus->unlock(m_dev);
+
+    // pick up where the pins are now, so the first update() doesn't report every low pin as a press
+    if (ok)
+        resetPortState();
+    return ok;
 }
 
 void UM_MCP23017::updateRegisterBit(uint8_t pin, uint8_t pValue, uint8_t portAaddr, uint8_t portBaddr)
 {
     uint8_t regAddr = (pin < 8) ? portAaddr : portBaddr;
     uint8_t bit = pin % 8;
+
+    // hold the bus so nothing else can change the register between our read and write
+    m_bus->lock(m_dev);
     uint8_t regValue = read(regAddr);
 
     // set the value for the particular bit
     bitWrite(regValue, bit, pValue);
 
     write(regAddr, regValue);
+    m_bus->unlock(m_dev);
 }
 
 bool UM_MCP23017::write(uint8_t addr, uint8_t value)
 {
-    Wire.beginTransmission(m_i2cAddress);
-    Wire.write(addr);
-    Wire.write(value);
-    if (Wire.endTransmission() == 0)
-        return true;
-    return false;
+    uint8_t buf[2] = {addr, value};
+    return m_bus->write(m_dev, buf, 2);
 }
 
 uint8_t UM_MCP23017::read(unsigned int addr)
 {
-    unsigned int value;
-    Wire.beginTransmission(m_i2cAddress);
-    Wire.write(addr);
-    if (Wire.endTransmission(false) != 0)
-        return 0;
-    if (Wire.requestFrom((int)m_i2cAddress, 2) < 2)
+    uint8_t reg = addr;
+    uint8_t value;
+    if (!m_bus->writeRead(m_dev, &reg, 1, &value, 1))
         return 0;
-    value = Wire.read();
     return value;
 }
 
@@ -51,6 +106,8 @@ void UM_MCP23017::digitalWrite(uint8_t pin, uint8_t value)
     uint8_t gpio;
     uint8_t bit = pin % 8;
 
+    m_bus->lock(m_dev);
+
     // read the current GPIO output latches
     uint8_t regAddr = (pin < 8) ? MCP23017_OLATA : MCP23017_OLATB;
     gpio = read(regAddr);
@@ -61,6 +118,8 @@ void UM_MCP23017::digitalWrite(uint8_t pin, uint8_t value)
     // write the new GPIO
     regAddr = (pin < 8) ? MCP23017_GPIOA : MCP23017_GPIOB;
     write(regAddr, gpio);
+
+    m_bus->unlock(m_dev);
 }
 
 uint8_t UM_MCP23017::digitalRead(uint8_t pin)
@@ -83,30 +142,49 @@ void UM_MCP23017::pullUp(uint8_t p, uint8_t d)
 
 uint8_t UM_MCP23017::readPorts(uint8_t port)
 {
-    Wire.beginTransmission(m_i2cAddress);
-    Wire.write(port);
-    Wire.endTransmission();
-
-    Wire.requestFrom((int)m_i2cAddress, 1);
-    return Wire.read();
+    uint8_t value = 0;
+    m_bus->writeRead(m_dev, &port, 1, &value, 1);
+    return value;
 }
 
 uint16_t UM_MCP23017::readPorts()
 {
-    uint16_t ba = 0;
-    uint8_t a;
+    // read both GPIO ports in one transaction
+    uint8_t reg = MCP23017_GPIOA;
+    uint8_t ab[2] = {0, 0};
+    m_bus->writeRead(m_dev, &reg, 1, ab, 2);
 
-    // read the current GPIO output latches
-    Wire.beginTransmission(m_i2cAddress);
-    Wire.write(MCP23017_GPIOA);
-    Wire.endTransmission();
-    Wire.requestFrom((int)m_i2cAddress, 2);
-    a = Wire.read();
-    ba = Wire.read();
-    ba <<= 8;
-    ba |= a;
+    return ((uint16_t)ab[1] << 8) | ab[0];
+}
 
-    return ba;
+bool UM_MCP23017::writePorts(uint16_t value)
+{
+    // the register pointer steps from OLATA to OLATB in sequential mode
+    uint8_t buf[3] = {MCP23017_OLATA, (uint8_t)(value & 0xFF), (uint8_t)(value >> 8)};
+    return m_bus->write(m_dev, buf, 3);
+}
+
+uint16_t UM_MCP23017::readLatches()
+{
+    uint8_t reg = MCP23017_OLATA;
+    uint8_t ab[2] = {0, 0};
+    m_bus->writeRead(m_dev, &reg, 1, ab, 2);
+
+    return ((uint16_t)ab[1] << 8) | ab[0];
+}
+
+bool UM_MCP23017::readPortsAsync(UM_I2CTransfer &xfer)
+{
+    uint8_t reg = MCP23017_GPIOA;
+    xfer.setWriteRead(m_dev, &reg, 1, 2);
+    return m_bus->submit(xfer);
+}
+
+bool UM_MCP23017::writePortsAsync(uint16_t value, UM_I2CTransfer &xfer)
+{
+    uint8_t buf[3] = {MCP23017_OLATA, (uint8_t)(value & 0xFF), (uint8_t)(value >> 8)};
+    xfer.setWrite(m_dev, buf, 3);
+    return m_bus->submit(xfer);
 }
 
 // INTCON / 0x0A & 0x0B / Configuration Register / Page 20 / 3.5.6
@@ -115,6 +193,8 @@ uint16_t UM_MCP23017::readPorts()
 //     BANK     MIRROR  SEQOP   DISSLW  HAEN    ODR     INTPOL  -
 void UM_MCP23017::setupInterrupts(uint8_t mirrorIntPin, uint8_t openDrain, uint8_t polarity)
 {
+    m_bus->lock(m_dev);
+
     // configure the port A
     uint8_t ioconfValue = read(MCP23017_IOCONA);
     bitWrite(ioconfValue, 6, mirrorIntPin);
@@ -128,6 +208,8 @@ void UM_MCP23017::setupInterrupts(uint8_t mirrorIntPin, uint8_t openDrain, uint8
     bitWrite(ioconfValue, 2, openDrain);
     bitWrite(ioconfValue, 1, polarity);
     write(MCP23017_IOCONB, ioconfValue);
+
+    m_bus->unlock(m_dev);
 }
 
 void UM_MCP23017::setupInterruptPin(uint8_t pin, uint8_t mode)
@@ -186,15 +268,75 @@ uint8_t UM_MCP23017::getLastInterruptPinValue()
     return MCP23017_INT_ERR;
 }
 
+// INTF and INTCAP for both ports sit next to each other (0x0E - 0x11), so one burst read gets the
+// pins that caused the interrupt and their captured values, and clears the interrupt.
+bool UM_MCP23017::readInterruptState(uint16_t *flags, uint16_t *captured)
+{
+    uint8_t reg = MCP23017_INTFA;
+    uint8_t buf[4]; // INTFA, INTFB, INTCAPA, INTCAPB
+    if (!m_bus->writeRead(m_dev, &reg, 1, buf, 4))
+        return false;
+
+    *flags = ((uint16_t)buf[1] << 8) | buf[0];
+    *captured = ((uint16_t)buf[3] << 8) | buf[2];
+    return true;
+}
+
+void UM_MCP23017::resetPortState()
+{
+    m_prevPorts = readPorts();
+    m_debouncer.reset(m_prevPorts);
+}
+
+void UM_MCP23017::setRepeat(uint16_t pinMask, uint16_t delayMs, uint16_t rateMs)
+{
+    m_repeatMask = pinMask;
+    m_repeatDelay = delayMs;
+    m_repeatRate = rateMs;
+    m_nextRepeat = millis() + m_repeatDelay;
+}
+
 void UM_MCP23017::update()
 {
-    uint16_t ports = readPorts();
+    uint16_t sample = readPorts();
+    // a failed read isn't a sample - don't let it look like every button was pressed
+    if (lastError() != I2C_RESULT_OK)
+        return;
+    if (m_debounce)
+        m_debouncer.update(sample);
+    else
+        m_debouncer.reset(sample);
+
+    // the debouncer's stable state is the port state, so the two can't drift apart
+    uint16_t ports = m_debouncer.state();
+    uint16_t changed = ports ^ m_prevPorts;
+    m_prevPorts = ports;
+
+    // ports are pullups, so a press is a high to low transition
+    uint16_t pressed = changed & ~ports;
+    uint16_t released = changed & ports;
 
-    if (ports ^ m_prevPorts) // if change
-    for (int i = 0; i < 16; i++)
+    // auto repeat for held pins, restarted whenever any repeating pin changes
+    uint16_t repeated = 0;
+    uint16_t held = ~ports & m_repeatMask;
+    if (changed & m_repeatMask)
     {
-        if (((ports & m_callbackPortMask) & (1UL << i)) ^ (((m_prevPorts & m_callbackPortMask) & (1UL << i))))
-            m_cb.change(ports, i, !(ports & (1UL << i)));
+        m_nextRepeat = millis() + m_repeatDelay;
     }
-    m_prevPorts = ports;
-}
\ No newline at end of file
+    else if (held && m_repeatRate > 0 && (long)(millis() - m_nextRepeat) >= 0)
+    {
+        repeated = held;
+        m_nextRepeat += m_repeatRate;
+    }
+
+    m_cb.dispatch(ports, pressed, released, repeated);
+
+    // single pin callback, only walk the bits that actually changed
+    uint16_t bits = changed & m_callbackPortMask;
+    while (bits)
+    {
+        uint8_t i = __builtin_ctz(bits);
+        bits &= bits - 1;
+        m_cb.change(ports, i, !(ports & (1UL << i)));
+    }
+}
@@ -3,6 +3,7 @@
 
 #include <Arduino.h>
 #include <Wire.h>
+#include "I2CBus.h"
 
 #define MCP23017_ADDRESS 0x20
 
@@ -50,12 +51,59 @@
 #define BUTTON14 0x4000 // 0100000000000000
 #define BUTTON15 0x8000 // 1000000000000000
 
+// Edge types for GPIOEvents subscribers
+#define GPIO_EDGE_PRESS 0x01   // pin went low (inputs are pulled up, so this is a button press)
+#define GPIO_EDGE_RELEASE 0x02 // pin went high
+#define GPIO_EDGE_REPEAT 0x04  // pin is being held low, fired at the configured repeat rate
+#define GPIO_EDGE_CHANGE (GPIO_EDGE_PRESS | GPIO_EDGE_RELEASE)
+
+#define GPIO_MAX_SUBSCRIBERS 4
+
+// Vertical counter debouncer
+// Each pin gets a 2 bit counter, stored one bit per word (ct0/ct1), so all 16 pins are filtered
+// at once with a handful of bitwise ops. A pin only changes state after 4 consecutive samples that
+// differ from its current stable state.
+class GPIODebouncer
+{
+public:
+    GPIODebouncer() { reset(0xFFFF); }
+    void reset(uint16_t state)
+    {
+        m_state = state;
+        m_ct0 = 0xFFFF;
+        m_ct1 = 0xFFFF;
+    }
+
+    // returns the bits that changed stable state with this sample
+    inline uint16_t update(uint16_t sample)
+    {
+        uint16_t delta = m_state ^ sample; // which pins differ from the stable state
+        m_ct0 = ~(m_ct0 & delta);          // reset the counter of pins that agree, count the rest
+        m_ct1 = m_ct0 ^ (m_ct1 & delta);
+        uint16_t toggled = delta & m_ct0 & m_ct1; // counters that rolled over
+        m_state ^= toggled;
+        return toggled;
+    }
+
+    uint16_t state() { return m_state; }
+
+private:
+    uint16_t m_state;
+    uint16_t m_ct0;
+    uint16_t m_ct1;
+};
+
 // Event class used for callbacks
 class GPIOEvents
 {
 public:
     GPIOEvents() { ClearCBs(); }
-    void ClearCBs() { chngFn = NULL; };
+    void ClearCBs()
+    {
+        chngFn = NULL;
+        for (int i = 0; i < GPIO_MAX_SUBSCRIBERS; i++)
+            m_subs[i].fn = NULL;
+    };
 
     typedef void (*chngCBFn)(uint16_t ports, uint8_t button, bool state);
     bool RegisterChangeCB(chngCBFn f)
@@ -69,15 +117,100 @@ public:
             chngFn(ports, button, state);
     }
 
+    // Subscribers get one call per edge type, with all the pins in their mask that had that edge
+    typedef void (*eventCBFn)(void *context, uint16_t ports, uint16_t pins, uint8_t edge);
+
+    // returns a handle for Unsubscribe, or -1 if all subscriber slots are in use
+    int Subscribe(eventCBFn fn, uint16_t pinMask, uint8_t edges, void *context)
+    {
+        for (int i = 0; i < GPIO_MAX_SUBSCRIBERS; i++)
+        {
+            if (m_subs[i].fn == NULL)
+            {
+                m_subs[i].pinMask = pinMask;
+                m_subs[i].edges = edges;
+                m_subs[i].context = context;
+                m_subs[i].fn = fn;
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    bool Unsubscribe(int handle)
+    {
+        if (handle < 0 || handle >= GPIO_MAX_SUBSCRIBERS)
+            return false;
+        m_subs[handle].fn = NULL;
+        return true;
+    }
+
+    inline void dispatch(uint16_t ports, uint16_t pressed, uint16_t released, uint16_t repeated)
+    {
+        if (!(pressed | released | repeated))
+            return;
+
+        for (int i = 0; i < GPIO_MAX_SUBSCRIBERS; i++)
+        {
+            Subscriber &s = m_subs[i];
+            if (s.fn == NULL)
+                continue;
+            if ((s.edges & GPIO_EDGE_PRESS) && (pressed & s.pinMask))
+                s.fn(s.context, ports, pressed & s.pinMask, GPIO_EDGE_PRESS);
+            if ((s.edges & GPIO_EDGE_RELEASE) && (released & s.pinMask))
+                s.fn(s.context, ports, released & s.pinMask, GPIO_EDGE_RELEASE);
+            if ((s.edges & GPIO_EDGE_REPEAT) && (repeated & s.pinMask))
+                s.fn(s.context, ports, repeated & s.pinMask, GPIO_EDGE_REPEAT);
+        }
+    }
+
 private:
+    struct Subscriber
+    {
+        eventCBFn fn;
+        void *context;
+        uint16_t pinMask;
+        uint8_t edges;
+    };
+
     chngCBFn chngFn;
+    Subscriber m_subs[GPIO_MAX_SUBSCRIBERS];
+};
+
+// IODIRA (0x00) to GPPUB (0x0D) - everything pinMode, pullUp and the interrupt setup write
+#define MCP23017_CONFIG_REGS 14
+
+// Register image for keeping in RTC memory across deep sleep. It has to be declared by the sketch,
+// as it's the RTC_DATA_ATTR that puts it there:
+//   RTC_DATA_ATTR UM_MCP23017Snapshot mcpState;
+// It is all zero (not valid) after a power on reset.
+struct UM_MCP23017Snapshot
+{
+    uint8_t valid;
+    uint8_t address;
+    uint8_t config[MCP23017_CONFIG_REGS];
+    uint8_t latches[2];
 };
 
 class UM_MCP23017
 {
 public:
     void begin(void) { begin(MCP23017_ADDRESS); }
-    void begin(uint8_t addr);
+    void begin(uint8_t addr) { begin(addr, I2CBus0); }
+    void begin(uint8_t addr, UM_I2CBus &bus);
+    // Deep sleep support - snapshot() the configuration before sleeping, then resume() instead of
+    // begin() and the pin setup after waking. resume() checks whether the chip kept its registers
+    // (one read) and only writes the image back (two burst writes) if it didn't. Returns false if
+    // the snapshot isn't valid or the chip didn't answer, in which case do the full begin() and setup.
+    bool snapshot(UM_MCP23017Snapshot &snap);
+    bool resume(const UM_MCP23017Snapshot &snap, UM_I2CBus &bus = I2CBus0);
+    void setBusPriority(i2cPriority_t priority)
+    {
+        if (m_dev)
+            m_dev->priority = priority;
+    }
+    // result of the last bus transaction - reads return 0 on failure, so check this when it matters
+    i2cResult_t lastError() { return m_dev ? m_dev->lastResult : I2C_RESULT_BUSY; }
 
     void updateRegisterBit(uint8_t pin, uint8_t pValue, uint8_t portAaddr, uint8_t portBaddr);
     bool write(uint8_t addr, uint8_t value);
@@ -91,11 +224,20 @@ public:
 
     uint16_t readPorts();
     uint8_t readPorts(uint8_t port);
+    // both output latches in one transaction, port A in the low byte
+    bool writePorts(uint16_t value);
+    uint16_t readLatches();
+
+    // Asynchronous port access through the bus worker (see UM_I2CBus::beginAsync)
+    bool readPortsAsync(UM_I2CTransfer &xfer);
+    bool writePortsAsync(uint16_t value, UM_I2CTransfer &xfer);
+    static uint16_t portsResult(const UM_I2CTransfer &xfer) { return ((uint16_t)xfer.rx[1] << 8) | xfer.rx[0]; }
 
     void setupInterrupts(uint8_t mirrorIntPin, uint8_t openDrain, uint8_t polarity);
     void setupInterruptPin(uint8_t p, uint8_t mode);
     uint8_t getLastInterruptPin();
     uint8_t getLastInterruptPinValue();
+    bool readInterruptState(uint16_t *flags, uint16_t *captured);
 
     bool RegisterChangeCB(GPIOEvents::chngCBFn fn)
     {
@@ -104,18 +246,40 @@ public:
 
     bool RegisterChangeCB(GPIOEvents::chngCBFn fn, uint16_t portMask)
     {
-        m_prevPorts = readPorts();
+        resetPortState();
         m_callbackPortMask = portMask;
         return m_cb.RegisterChangeCB(fn);
     }
 
+    int Subscribe(GPIOEvents::eventCBFn fn, uint16_t pinMask, uint8_t edges, void *context)
+    {
+        resetPortState();
+        return m_cb.Subscribe(fn, pinMask, edges, context);
+    }
+    bool Unsubscribe(int handle) { return m_cb.Unsubscribe(handle); }
+
+    // debouncing is on by default and delays each edge by 4 calls to update()
+    void setDebounce(bool enabled) { m_debounce = enabled; }
+    // pins in pinMask that are held low fire GPIO_EDGE_REPEAT after delayMs, then every rateMs
+    void setRepeat(uint16_t pinMask, uint16_t delayMs, uint16_t rateMs);
+
     void update();
 
 private:
+    void resetPortState();
+
     GPIOEvents m_cb;
+    GPIODebouncer m_debouncer;
+    UM_I2CBus *m_bus = &I2CBus0;
+    UM_I2CDevice *m_dev = NULL;
     uint8_t m_i2cAddress;
-    uint16_t m_prevPorts = 0;
+    uint16_t m_prevPorts = 0xFFFF; // idle pullup inputs, like the debouncer starts
     uint16_t m_callbackPortMask = 0xFF;
+    bool m_debounce = true;
+    uint16_t m_repeatMask = 0;
+    uint16_t m_repeatDelay = 500;
+    uint16_t m_repeatRate = 100;
+    unsigned long m_nextRepeat = 0;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,118 @@
+#include "TerminalDashboard.h"
+
+int UM_TerminalDashboard::addField(uint8_t row, uint8_t col, uint8_t width)
+{
+    if (m_numFields >= DASHBOARD_MAX_FIELDS || width == 0 || width > DASHBOARD_MAX_WIDTH)
+        return -1;
+
+    Field &f = m_fields[m_numFields];
+    f.row = row;
+    f.col = col;
+    f.width = width;
+    f.dirty = false;
+    memset(f.shown, 0, sizeof(f.shown)); // nothing printable, so the first set always draws
+    memset(f.pending, ' ', sizeof(f.pending));
+
+    return m_numFields++;
+}
+
+void UM_TerminalDashboard::set(int id, const char *text, uint8_t len, bool rightAlign)
+{
+    if (id < 0 || id >= m_numFields)
+        return;
+
+    Field &f = m_fields[id];
+    if (len > f.width)
+        len = f.width;
+
+    char value[DASHBOARD_MAX_WIDTH];
+    memset(value, ' ', f.width);
+    memcpy(rightAlign ? &value[f.width - len] : value, text, len);
+
+    if (memcmp(value, f.shown, f.width) != 0)
+    {
+        memcpy(f.pending, value, f.width);
+        f.dirty = true;
+    }
+    else
+    {
+        // changed and then changed back before a flush
+        f.dirty = false;
+    }
+}
+
+void UM_TerminalDashboard::setText(int id, const char *text)
+{
+    set(id, text, strlen(text), false);
+}
+
+void UM_TerminalDashboard::setUnsigned(int id, uint32_t value)
+{
+    char buf[10];
+    uint8_t pos = sizeof(buf);
+    do
+    {
+        buf[--pos] = '0' + (value % 10);
+        value /= 10;
+    } while (value && pos > 0);
+
+    set(id, &buf[pos], sizeof(buf) - pos, true);
+}
+
+void UM_TerminalDashboard::setBits(int id, uint32_t value, uint8_t bits)
+{
+    char buf[32];
+    if (bits > 32)
+        bits = 32;
+    for (uint8_t i = 0; i < bits; i++)
+        buf[i] = (value & (1UL << (bits - 1 - i))) ? '1' : '0';
+
+    set(id, buf, bits, false);
+}
+
+void UM_TerminalDashboard::invalidate()
+{
+    for (int i = 0; i < m_numFields; i++)
+    {
+        memset(m_fields[i].shown, 0, sizeof(m_fields[i].shown));
+        m_fields[i].dirty = false;
+    }
+}
+
+void UM_TerminalDashboard::append(const char *data, size_t len)
+{
+    if (m_used + len > DASHBOARD_BUFFER_SIZE)
+    {
+        m_written += m_out.write((const uint8_t *)m_buffer, m_used);
+        m_used = 0;
+    }
+    memcpy(&m_buffer[m_used], data, len);
+    m_used += len;
+}
+
+size_t UM_TerminalDashboard::flush()
+{
+    m_used = 0;
+    m_written = 0;
+
+    for (int i = 0; i < m_numFields; i++)
+    {
+        Field &f = m_fields[i];
+        if (!f.dirty)
+            continue;
+
+        // cursor move, then the field text
+        char seq[12];
+        int n = snprintf(seq, sizeof(seq), "\033[%u;%uH", f.row, f.col);
+        append(seq, n);
+        append(f.pending, f.width);
+
+        memcpy(f.shown, f.pending, f.width);
+        f.dirty = false;
+    }
+
+    if (m_used > 0)
+        m_written += m_out.write((const uint8_t *)m_buffer, m_used);
+
+    return m_written;
+}
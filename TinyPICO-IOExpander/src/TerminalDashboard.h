@@ -0,0 +1,55 @@
+#ifndef _UM_TERMINALDASHBOARD_H_
+#define _UM_TERMINALDASHBOARD_H_
+
+#include <Arduino.h>
+
+#define DASHBOARD_MAX_FIELDS 48
+#define DASHBOARD_MAX_WIDTH 16
+#define DASHBOARD_BUFFER_SIZE 512
+
+// Diff based ANSI terminal dashboard
+// The screen is a static frame (drawn once by the caller) plus fixed width fields. Each field keeps a
+// shadow copy of what is on the terminal, and flush() only emits cursor moves and text for fields
+// whose value changed, batched into as few writes as possible.
+class UM_TerminalDashboard
+{
+public:
+    UM_TerminalDashboard(Print &out) : m_out(out) {}
+
+    // row and col are 1 based terminal coordinates. Returns a field id, or -1 if there is no room.
+    int addField(uint8_t row, uint8_t col, uint8_t width);
+
+    void setText(int id, const char *text);            // left aligned, space padded
+    void setUnsigned(int id, uint32_t value);          // right aligned
+    void setBits(int id, uint32_t value, uint8_t bits); // binary, MSB first
+
+    // The terminal was cleared or redrawn - forget what we think is on it
+    void invalidate();
+
+    // Emit all changed fields, returns the number of bytes written
+    size_t flush();
+
+private:
+    struct Field
+    {
+        uint8_t row;
+        uint8_t col;
+        uint8_t width;
+        bool dirty;
+        char shown[DASHBOARD_MAX_WIDTH];
+        char pending[DASHBOARD_MAX_WIDTH];
+    };
+
+    void set(int id, const char *text, uint8_t len, bool rightAlign);
+    void append(const char *data, size_t len);
+
+    Print &m_out;
+    Field m_fields[DASHBOARD_MAX_FIELDS];
+    uint8_t m_numFields = 0;
+
+    char m_buffer[DASHBOARD_BUFFER_SIZE];
+    size_t m_used = 0;
+    size_t m_written = 0;
+};
+
+#endif
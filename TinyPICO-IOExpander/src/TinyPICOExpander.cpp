@@ -4,19 +4,92 @@ const uint8_t sdCardSelect = 5;
 const uint8_t sdCardDetect = 33;
 
 
-TinyPICOExpander::TinyPICOExpander() {
-    ads = new UM_ADS1015();
-    mcp = new UM_MCP23017();
+void TinyPICOExpanderBase::attachInterruptQueue(uint8_t gpio, int mode)
+{
+    m_intGpio = gpio;
+    m_intActive = mode == RISING ? HIGH : LOW;
+    pinMode(gpio, INPUT);
+
+    // A change from before we were listening holds INT asserted, and no edge would ever come
+    uint16_t flags, captured;
+    mcp.readInterruptState(&flags, &captured);
+    m_retryPending = false;
+
+    attachInterruptArg(digitalPinToInterrupt(gpio), interruptISR, this, mode);
 }
 
-void TinyPICOExpander::begin()
+void TinyPICOExpanderBase::detachInterruptQueue()
 {
-    mcp->begin();
-    ads->begin();
+    if (m_intGpio < 0)
+        return;
+    detachInterrupt(digitalPinToInterrupt(m_intGpio));
+    m_intGpio = -1;
 }
 
-void TinyPICOExpander::begin(uint8_t MCP_I2C_Address, uint8_t ADS_I2C_Address)
+void IRAM_ATTR TinyPICOExpanderBase::interruptISR(void *arg)
 {
-    mcp->begin(MCP_I2C_Address);
-    ads->begin(ADS_I2C_Address);
+    // No I2C in here - just record when it happened
+    TinyPICOExpanderBase *self = (TinyPICOExpanderBase *)arg;
+    ExpanderEdge edge = {(uint32_t)micros(), self->m_missedEdges};
+
+    if (self->m_edges.push(edge))
+        self->m_missedEdges = 0;
+    else
+        self->m_missedEdges++;
+}
+
+bool TinyPICOExpanderBase::processEdge(const ExpanderEdge &edge)
+{
+    uint16_t flags, captured;
+
+    // reading the captured state also clears the interrupt on the MCP23017
+    if (!mcp.readInterruptState(&flags, &captured))
+        return false;
+
+    if (m_intFn == NULL)
+        return true;
+
+    while (flags)
+    {
+        uint8_t pin = __builtin_ctz(flags);
+        flags &= flags - 1;
+        m_intFn(edge.time, pin, (captured >> pin) & 0x01, edge.missed);
+    }
+    return true;
+}
+
+uint16_t TinyPICOExpanderBase::processInterrupts()
+{
+    ExpanderEdge edge;
+    uint16_t processed = 0;
+
+    // the change behind a failed read is still latched on the chip, so it goes first, with its own time
+    if (m_retryPending)
+    {
+        if (!processEdge(m_retryEdge))
+            return 0;
+        m_retryPending = false;
+        processed++;
+    }
+
+    while (m_edges.pop(edge))
+    {
+        if (!processEdge(edge))
+        {
+            m_retryEdge = edge;
+            m_retryPending = true;
+            return processed;
+        }
+        processed++;
+    }
+
+    for (uint8_t i = 0; i < EXPANDER_DRAIN_READS && m_intGpio >= 0 && digitalRead(m_intGpio) == m_intActive; i++)
+    {
+        ExpanderEdge drained = {(uint32_t)micros(), 0};
+        if (!processEdge(drained))
+            break;
+        processed++;
+    }
+
+    return processed;
 }
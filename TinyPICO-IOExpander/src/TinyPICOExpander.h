@@ -4,42 +4,141 @@
 #include <Arduino.h>
 #include "MCP23017.h"
 #include "ADS1015.h"
+#include "EventQueue.h"
 
-class TinyPICOExpander
+// Number of interrupt edges that can be queued between calls to processInterrupts() - must be a power of 2
+#define EXPANDER_EDGE_QUEUE_SIZE 32
+
+// Reads processInterrupts() makes at most to get INT to let go once the queue is empty
+#define EXPANDER_DRAIN_READS 4
+
+// Interrupt edge as recorded by the ISR
+struct ExpanderEdge
+{
+    uint32_t time;   // micros() when the edge fired
+    uint16_t missed; // edges lost to a full queue just before this one
+};
+
+// Both drivers' state, for keeping in RTC memory across deep sleep
+//   RTC_DATA_ATTR TinyPICOExpanderSnapshot expanderState;
+struct TinyPICOExpanderSnapshot
+{
+    UM_MCP23017Snapshot mcp;
+    UM_ADS1015Snapshot ads;
+};
+
+// Shared by both expander classes below. The drivers are held by value, so there is no heap
+// allocation and every forwarded call inlines down to the driver.
+class TinyPICOExpanderBase
 {
 public:
-    TinyPICOExpander();
-    void begin();
-    void begin(uint8_t MCP_I2C_Address, uint8_t ADS_I2C_Address);
+    // Call snapshot() before deep sleep. After waking, resume() replaces begin() and the pin setup -
+    // if it returns false, do the full begin() and setup instead.
+    bool snapshot(TinyPICOExpanderSnapshot &snap) { return mcp.snapshot(snap.mcp) && ads.snapshot(snap.ads); }
+    bool resume(const TinyPICOExpanderSnapshot &snap, UM_I2CBus &bus = I2CBus0) { return mcp.resume(snap.mcp, bus) && ads.resume(snap.ads, bus); }
 
     // digital
-    void digitalWrite(uint8_t pin, uint8_t value) { mcp->digitalWrite(pin, value); }
-    uint8_t digitalRead(uint8_t pin) { return mcp->digitalRead(pin); }
-    void pinMode(uint8_t pin, uint8_t mode) { mcp->pinMode(pin, mode); }
-    void pullUp(uint8_t p, uint8_t d) { mcp->pullUp(p, d); }
-    uint16_t readPorts() { return mcp->readPorts(); }
-    uint8_t readPorts(uint8_t port) { return mcp->readPorts(port); }
-    void setupInterrupts(uint8_t mirrorIntPin, uint8_t openDrain, uint8_t polarity) { mcp->setupInterrupts(mirrorIntPin, openDrain, polarity); }
-    void setupInterruptPin(uint8_t p, uint8_t mode) { mcp->setupInterruptPin(p, mode); }
-    uint8_t getLastInterruptPin() { return mcp->getLastInterruptPin(); }
-    uint8_t getLastInterruptPinValue() { return mcp->getLastInterruptPinValue(); }
-
-    bool RegisterChangeCB(GPIOEvents::chngCBFn fn) { return mcp->RegisterChangeCB(fn); }
-    bool RegisterChangeCB(GPIOEvents::chngCBFn fn, uint16_t portMask) { return mcp->RegisterChangeCB(fn, portMask); }
+    void digitalWrite(uint8_t pin, uint8_t value) { mcp.digitalWrite(pin, value); }
+    uint8_t digitalRead(uint8_t pin) { return mcp.digitalRead(pin); }
+    void pinMode(uint8_t pin, uint8_t mode) { mcp.pinMode(pin, mode); }
+    void pullUp(uint8_t p, uint8_t d) { mcp.pullUp(p, d); }
+    uint16_t readPorts() { return mcp.readPorts(); }
+    uint8_t readPorts(uint8_t port) { return mcp.readPorts(port); }
+    bool readPortsAsync(UM_I2CTransfer &xfer) { return mcp.readPortsAsync(xfer); }
+    void setupInterrupts(uint8_t mirrorIntPin, uint8_t openDrain, uint8_t polarity) { mcp.setupInterrupts(mirrorIntPin, openDrain, polarity); }
+    void setupInterruptPin(uint8_t p, uint8_t mode) { mcp.setupInterruptPin(p, mode); }
+    uint8_t getLastInterruptPin() { return mcp.getLastInterruptPin(); }
+    uint8_t getLastInterruptPinValue() { return mcp.getLastInterruptPinValue(); }
+
+    bool RegisterChangeCB(GPIOEvents::chngCBFn fn) { return mcp.RegisterChangeCB(fn); }
+    bool RegisterChangeCB(GPIOEvents::chngCBFn fn, uint16_t portMask) { return mcp.RegisterChangeCB(fn, portMask); }
+    int Subscribe(GPIOEvents::eventCBFn fn, uint16_t pinMask, uint8_t edges, void *context) { return mcp.Subscribe(fn, pinMask, edges, context); }
+    bool Unsubscribe(int handle) { return mcp.Unsubscribe(handle); }
+    void setDebounce(bool enabled) { mcp.setDebounce(enabled); }
+    void setRepeat(uint16_t pinMask, uint16_t delayMs, uint16_t rateMs) { mcp.setRepeat(pinMask, delayMs, rateMs); }
 
     // analog
-    uint16_t analogReadSingleEnded(uint8_t channel) { return ads->analogReadSingleEnded(channel); }
-    int16_t analogReadDifferential(uint8_t channel) { return ads->analogReadDifferential(channel); }
-    void startComparator(uint8_t channel, int16_t threshold) { ads->startComparator(channel, threshold); }
-    int16_t getLastConversionResults() { return ads->getLastConversionResults(); }
-    void analogSetGain(adsGain_t gain) { ads->analogSetGain(gain); }
-    adsGain_t analogGetGain(void) { return ads->analogGetGain(); }
+    uint16_t analogReadSingleEnded(uint8_t channel) { return ads.analogReadSingleEnded(channel); }
+    int16_t analogReadDifferential(uint8_t channel) { return ads.analogReadDifferential(channel); }
+    bool analogReadSingleEndedAsync(uint8_t channel, UM_I2CTransfer &xfer) { return ads.analogReadSingleEndedAsync(channel, xfer); }
+    bool analogReadDifferentialAsync(uint8_t channel, UM_I2CTransfer &xfer) { return ads.analogReadDifferentialAsync(channel, xfer); }
+    uint16_t singleEndedResult(const UM_I2CTransfer &xfer) { return ads.singleEndedResult(xfer); }
+    int16_t differentialResult(const UM_I2CTransfer &xfer) { return ads.differentialResult(xfer); }
+    void startComparator(uint8_t channel, int16_t threshold) { ads.startComparator(channel, threshold); }
+    int16_t getLastConversionResults() { return ads.getLastConversionResults(); }
+    void analogSetGain(adsGain_t gain) { ads.analogSetGain(gain); }
+    adsGain_t analogGetGain(void) { return ads.analogGetGain(); }
+    int32_t analogReadMilliVolts(uint8_t channel) { return ads.analogReadMilliVolts(channel); }
+    int32_t toMilliVolts(int16_t counts, uint8_t channel = 0) const { return ads.toMilliVolts(counts, channel); }
+    int32_t toMicroVolts(int16_t counts, uint8_t channel = 0) const { return ads.toMicroVolts(counts, channel); }
+    bool loadCalibration() { return ads.loadCalibration(); }
+
+    void update() { mcp.update(); };
 
-    void update() { mcp->update(); };
+    // Queued interrupt handling
+    // The ISR timestamps each edge on the expander INT pin into a lock free queue, and processInterrupts()
+    // resolves them over I2C into pin / value events from the main loop. A burst of edges is no longer
+    // collapsed into one, and anything lost to a full queue is counted and reported with the next edge.
+    // An edge whose read fails is kept and tried again on the next call, and if INT is still asserted
+    // once the queue is empty (an edge was lost, or it was already active) the state is read until it lets go.
+    typedef void (*intEventCBFn)(uint32_t timeUs, uint8_t pin, uint8_t value, uint16_t missed);
+    void attachInterruptQueue(uint8_t gpio, int mode = FALLING);
+    void detachInterruptQueue();
+    bool RegisterInterruptCB(intEventCBFn fn)
+    {
+        m_intFn = fn;
+        return true;
+    }
+    uint16_t processInterrupts();
+    uint32_t getInterruptOverruns() { return m_edges.overruns(); }
+    uint16_t getPendingInterrupts() { return m_edges.count(); }
+
+protected:
+    UM_ADS1015 ads;
+    UM_MCP23017 mcp;
 
 private:
-    UM_ADS1015 *ads;
-    UM_MCP23017 *mcp;
+    static void IRAM_ATTR interruptISR(void *arg);
+    bool processEdge(const ExpanderEdge &edge);
+
+    UM_EventQueue<ExpanderEdge, EXPANDER_EDGE_QUEUE_SIZE> m_edges;
+    volatile uint16_t m_missedEdges = 0;
+    int m_intGpio = -1;
+    int m_intActive = LOW;
+    ExpanderEdge m_retryEdge;
+    bool m_retryPending = false;
+    intEventCBFn m_intFn = NULL;
+};
+
+// Expander with its addresses, bus and ADC gain given in the type, so begin() takes no arguments.
+// The parameters are only what begin() passes on - the drivers still keep their address and bus at
+// runtime, so this generates the same code as TinyPICOExpander, it just keeps the set up in one place.
+//   TinyPICOExpanderT<0x21, 0x49> tpio;
+//   UM_I2CBus bus1(Wire1);
+//   TinyPICOExpanderT<MCP23017_ADDRESS, ADS1015_ADDRESS, bus1, GAIN_ONE> other;
+template <uint8_t McpAddr = MCP23017_ADDRESS, uint8_t AdsAddr = ADS1015_ADDRESS, UM_I2CBus &Bus = I2CBus0, adsGain_t Gain = GAIN_TWOTHIRDS>
+class TinyPICOExpanderT : public TinyPICOExpanderBase
+{
+public:
+    void begin()
+    {
+        mcp.begin(McpAddr, Bus);
+        ads.begin(AdsAddr, Bus);
+        ads.analogSetGain(Gain);
+    }
+};
+
+// Expander with its addresses chosen at runtime
+class TinyPICOExpander : public TinyPICOExpanderBase
+{
+public:
+    void begin() { begin(MCP23017_ADDRESS, ADS1015_ADDRESS, I2CBus0); }
+    void begin(uint8_t MCP_I2C_Address, uint8_t ADS_I2C_Address) { begin(MCP_I2C_Address, ADS_I2C_Address, I2CBus0); }
+    void begin(uint8_t MCP_I2C_Address, uint8_t ADS_I2C_Address, UM_I2CBus &bus)
+    {
+        mcp.begin(MCP_I2C_Address, bus);
+        ads.begin(ADS_I2C_Address, bus);
+    }
 };
 
 #endif
\ No newline at end of file
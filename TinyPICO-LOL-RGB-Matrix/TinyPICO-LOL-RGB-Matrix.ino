@@ -10,6 +10,7 @@
 #include <FastLED.h>
 #include <FastLED_NeoMatrix.h>
 #include <Fonts/TomThumb.h>
+#include <TinyPICOColor.h>
 
 #define PIN 14
 
@@ -48,8 +49,11 @@ FastLED_NeoMatrix *matrix = new FastLED_NeoMatrix(matrixleds, mw, mh, mw/8, 1,
   NEO_MATRIX_TOP     + NEO_MATRIX_LEFT +
     NEO_MATRIX_ROWS + NEO_MATRIX_PROGRESSIVE );
 
+// Worked out at compile time - red, green and blue around the hue wheel, as 5-6-5 for the GFX text colour
+using namespace TinyPICOColor;
 const uint16_t colors[] = {
-  matrix->Color(255, 0, 0), matrix->Color(0, 255, 0), matrix->Color(0, 0, 255) };
+  To565(HSV(0, 255, 255)), To565(HSV(85, 255, 255)), To565(HSV(170, 255, 255)) };
+#define NUMCOLORS (int)(sizeof(colors) / sizeof(colors[0]))
 
 void setup() {
   FastLED.addLeds<NEOPIXEL,PIN>(matrixleds, NUMMATRIX); 
@@ -70,7 +74,7 @@ void loop() {
   matrix->print(F("This is RGBLOL from @tinyledmatrix"));
   if(--x < -130) {
     x = matrix->width();
-    if(++pass >= 3) pass = 0;
+    if(++pass >= NUMCOLORS) pass = 0;
     matrix->setTextColor(colors[pass]);
   }
   matrix->show();
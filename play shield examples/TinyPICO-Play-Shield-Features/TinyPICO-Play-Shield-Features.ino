@@ -1,4 +1,12 @@
 #include <TinyPICO.h>
+#include <TinyPICOScheduler.h>
+#include <TinyPICOAccel.h>
+#include <TinyPICOOrientation.h>
+#include <TinyPICOBoot.h>
+#include <TinyPICOADC.h>
+#include <TinyPICOIOCore.h>
+#include <TinyPICOSnapshot.h>
+#include <TinyPICOProfiler.h>
 #include <SPI.h>
 #include <Wire.h>
 #include <WiFi.h>
@@ -9,6 +17,7 @@
 
 #include "secret.h"
 #include "bitmaps.h"
+#include "telemetry.h"
 
 #include <OneButton.h>
 
@@ -24,6 +33,9 @@ Adafruit_SSD1306 display( 128, 64, &Wire, -1 );
 // Declaration for the LIS3DH accelerometer
 Adafruit_LIS3DH lis = Adafruit_LIS3DH();
 
+// Streams LIS3DH samples from its FIFO - the Play shield doesn't connect the IMU interrupt, so the FIFO is polled
+TinyPICOAccel accel;
+
 // Setup 4 button references with default state as LOW
 OneButton button1(26, false);
 OneButton button2(27, false);
@@ -36,17 +48,54 @@ unsigned long nextButtonHelp = 0;
 uint8_t buttonHelpState = 0;
 
 
-unsigned long nextReadTimeIMU = 0;
-double roll = 0.00, pitch = 0.00;   //Roll & Pitch are the angles which rotate by the axis X and y
+// Runs the peripheral inits in setup() in parallel
+TinyPICOBoot boot;
+
+// Sensor polling - IMU FIFO every 50ms, light sensor every 500ms
+TinyPICOScheduler scheduler;
+int jobIMU = -1;
+int jobLightSensor = -1;
+int jobBattery = -1;
+int jobTelemetry = -1;
+
+// Samples the light sensor and battery continuously in the background
+TinyPICOADC adc;
+int adcLight = -1;
+
+// Batches sensor readings into UDP datagrams while WiFi is connected
+Telemetry telemetry;
+bool telemetryStarted = false;
+
+TinyPICOOrientation orientation;
 bool old_LED_state = false;
 
+// Buttons and sensors run on core 0, so a slow display.display() in loop() doesn't hold them up
+TinyPICOIOCore ioCore;
 
-unsigned long nextReadTimeLightSensor = 0;
-float lightSensorVal;
+// Everything the I/O side hands over to loop()
+struct PlayState
+{
+  float lightSensorVal;
+  double roll, pitch;         // Roll & Pitch are the angles which rotate by the axis X and y
+  bool showLightSensor;
+  bool showIMU;
+  uint32_t clicks[4];         // counts, so loop() can't miss one
+};
+
+// Only touched on the I/O side, then published whole
+PlayState ioState = { 0, 0.00, 0.00, true, true, { 0, 0, 0, 0 } };
+TinyPICOSnapshot<PlayState> sharedState;
+
+// Times loop(), the button ticks, the display flush and each sensor job, and prints a report every 10 seconds
+TinyPICOProfiler profiler;
+int markerLoop = -1;
+int markerButtons = -1;
+int markerDisplay = -1;
+
+// loop()'s copy, and what it had last time round
+PlayState state = ioState;
+PlayState lastState = ioState;
 
-// display states
-bool showLightSensor = true;
-bool showIMU = true;
 bool wasWifi = false;
 
 // Wifi Stuff
@@ -71,6 +120,70 @@ void setup()
 
   pinMode( LED, OUTPUT );
 
+  // Light sensor and battery share ADC1, so one engine samples both
+  adcLight = adc.AddChannel( LIGHT_SENSOR );
+  tp.UseADCEngine( adc );
+  if ( !adc.Begin() )
+    Serial.println("ADC engine failed to start");
+
+  // Attach the buttons to their callbacks
+  button1.attachClick(Click1);
+  button2.attachClick(Click2);
+  button3.attachClick(Click3);
+  button4.attachClick(Click4);
+
+  // Bring the display and IMU up in parallel, with the boot sound playing over the splash screen
+  int stageI2C = boot.AddStage("I2C", StageI2C);
+  int stageDisplay = boot.AddStage("Display", StageDisplay, NULL, TinyPICOBoot::After(stageI2C));
+  boot.AddStage("IMU", StageIMU, NULL, TinyPICOBoot::After(stageI2C));
+  boot.AddStage("Splash", StageSplash, NULL, TinyPICOBoot::After(stageDisplay));
+  boot.AddStage("Sound", StageSound);
+
+  bool booted = boot.Run();
+  boot.PrintReport(Serial);
+  if (!booted)
+  {
+    Serial.println("Boot failed - Execution halted!");
+    // Don't proceed, loop forever
+    while (1);
+  }
+
+  // Clear the buffer
+  display.clearDisplay();
+  display.display();
+
+  // Every sensor job gets a profiler marker of its own
+  markerLoop = profiler.AddMarker( "Loop" );
+  markerButtons = profiler.AddMarker( "Buttons" );
+  markerDisplay = profiler.AddMarker( "Display" );
+  scheduler.UseProfiler( profiler );
+
+  // Start polling the sensors
+  jobIMU = scheduler.AddJob( "IMU", ServiceAccel, NULL, 50 );
+  jobLightSensor = scheduler.AddJob( "Light", GrabLightSensor, NULL, 500 );
+  jobBattery = scheduler.AddJob( "Battery", GrabBattery, NULL, 1000 );
+  jobTelemetry = scheduler.AddJob( "Telemetry", ServiceTelemetry, NULL, 100 );
+
+  // From here on the buttons and the scheduler belong to the I/O task
+  sharedState.Write( ioState );
+  ioCore.SetPoll( TickButtons, NULL, 5 );
+  if ( !ioCore.Begin( scheduler ) )
+    Serial.println("I/O task failed to start");
+
+  // Set button help timer to 2 seconds from now to make sure we see the first item
+  nextButtonHelp = millis() + 2000;
+}
+
+// Boot stages - each runs in its own task once the stages it depends on are done
+
+// The display and IMU share Wire, so start it once here rather than have them race to do it
+bool StageI2C(void *context)
+{
+  return Wire.begin();
+}
+
+bool StageDisplay(void *context)
+{
   delay(200);
 
   // Initialise the SSD1306 OLED at address 0x03C
@@ -78,19 +191,21 @@ void setup()
   // SSD1306_SWITCHCAPVCC = generate display voltage from 3.3V internally
   if (!display.begin(SSD1306_SWITCHCAPVCC, 0x3C))
   {
-    Serial.println("SSD1306 allocation failed - Execution halted!");
-    // Don't proceed, loop forever
-    while (1);
+    Serial.println("SSD1306 allocation failed!");
+    return false;
   }
   Serial.println("SSD1306 OLED initialised");
+  return true;
+}
 
+bool StageIMU(void *context)
+{
   // Initialise the LIS3DH as address 0x18
   // Alternate I2C Address is 0x19
   if (! lis.begin(0x18))
   {
-    Serial.println("No LIS3DH IMU Found or failed to start - Execution halted!");
-    // Don't proceed, loop forever
-    while (1);
+    Serial.println("No LIS3DH IMU Found or failed to start!");
+    return false;
   }
   Serial.println("LIS3DH found and initialised!");
 
@@ -101,29 +216,27 @@ void setup()
   Serial.print(2 << lis.getRange());
   Serial.println("G");
 
-  // Attach the buttons to their callbacks
-  button1.attachClick(Click1);
-  button2.attachClick(Click2);
-  button3.attachClick(Click3);
-  button4.attachClick(Click4);
+  // Hand over to the FIFO - 100Hz samples delivered in blocks of 16
+  accel.begin( 0x18, -1, ACCEL_ODR_100HZ, 16 );
+  accel.AddConsumer( GrabAccel, NULL );
+  return true;
+}
 
-  // Show initial TinyPICO Logo as a splash screen.
+bool StageSplash(void *context)
+{
+  // Show initial TinyPICO Logo as a splash screen, and leave it up for 2 seconds
   display.clearDisplay();
   display.drawBitmap( 0, (64 - 30) / 2, TP_Logo, 128, 30, 1);
   display.display();
+  delay(2000);
+  return true;
+}
 
+bool StageSound(void *context)
+{
   // Play a boot sound
   BootSound();
-
-  // Pause for 2 seconds
-  delay(2000);
-
-  // Clear the buffer
-  display.clearDisplay();
-  display.display();
-
-  // Set button help timer to 2 seconds from now to make sure we see the first item
-  nextButtonHelp = millis() + 2000;
+  return true;
 }
 
 void BootSound()
@@ -137,12 +250,25 @@ void BootSound()
   tp.NoTone( AUDIO );
 }
 
-void loop() {
-  // put your main code here, to run repeatedly:
+// I/O side - runs every 5ms on core 0, ahead of whichever sensor read is due
+void TickButtons( void *context )
+{
+  PROFILE_SCOPE( profiler, markerButtons );
   button1.tick();
   button2.tick();
   button3.tick();
   button4.tick();
+}
+
+void loop() {
+  // put your main code here, to run repeatedly:
+  PROFILE_MARK( profiler, markerLoop );
+  profiler.Report( Serial, 10000 );
+
+  // Pick up the latest sensor readings and button presses from the I/O side
+  lastState = state;
+  sharedState.Read( state );
+  HandleClicks();
 
   if ( currentState == 1 )
   {
@@ -248,24 +374,22 @@ void loop() {
     display.setTextSize(2);
     display.setTextColor(WHITE);
 
-    if ( showLightSensor )
+    if ( state.showLightSensor )
     {
       display.fillRect( 0, 15, 127, 14, BLACK);
       display.setCursor(0, 15);
-      display.println( String( GrabLightSensor() ) );
+      display.println( String( state.lightSensorVal ) );
     }
 
-    if ( showIMU )
+    if ( state.showIMU )
     {
-      GrabAccel();
-
       display.fillRect( 0, 30, 127, 30, BLACK);
       display.setCursor(0, 30);
-      display.println( String( roll) );
-      display.println( String( pitch ));
+      display.println( String( state.roll) );
+      display.println( String( state.pitch ));
 
       // If the Pitch and Roll are close to 0,0, turn  on the blue LED
-      bool LED_STATE = ( abs(roll) < 1 ) && ( abs( pitch ) < 1 );
+      bool LED_STATE = ( abs(state.roll) < 1 ) && ( abs( state.pitch ) < 1 );
       if ( LED_STATE != old_LED_state )
       {
         old_LED_state = LED_STATE;
@@ -291,92 +415,120 @@ void loop() {
       }
     }
 
-    display.display();
+    {
+      PROFILE_SCOPE( profiler, markerDisplay );
+      display.display();
+    }
   }
 }
+// Button callbacks - these run on the I/O side, from TickButtons()
 void Click1()
 {
-  buttonStates[0] = 10;
+  ioState.clicks[0]++;
   ToggleLightSensor();
 }
 
 void Click2()
 {
-  buttonStates[1] = 10;
+  ioState.clicks[1]++;
   ToggleIMU();
 }
 
 void Click3()
 {
-  buttonStates[2] = 10;
+  ioState.clicks[2]++;
+  sharedState.Write( ioState );
 }
 
 void Click4()
 {
-  buttonStates[3] = 10;
-  currentState = 1;
-
+  ioState.clicks[3]++;
+  sharedState.Write( ioState );
 }
 
 void ToggleLightSensor()
 {
-  if ( showLightSensor )
-  {
-    display.fillRect( 0, 15, 127, 14, BLACK);
-  }
-  else
-  {
-    nextReadTimeLightSensor = 0;
-  }
-  showLightSensor = !showLightSensor;
+  ioState.showLightSensor = !ioState.showLightSensor;
+  sharedState.Write( ioState );
+
+  // No point reading a sensor we aren't showing
+  scheduler.SetEnabled( jobLightSensor, ioState.showLightSensor );
 }
 
 void ToggleIMU()
 {
-  if ( showIMU )
-  {
-    display.fillRect( 0, 30, 127, 30, BLACK);
-  }
-  else
-  {
-    nextReadTimeIMU = 0;
-  }
-  showIMU = !showIMU;
+  ioState.showIMU = !ioState.showIMU;
+  sharedState.Write( ioState );
+
+  scheduler.SetEnabled( jobIMU, ioState.showIMU );
 }
 
-float GrabLightSensor()
+// loop() side - act on whatever the I/O side has done since last time
+void HandleClicks()
 {
-  // If it's not time to read the input, return the cached value
-  if ( nextReadTimeLightSensor > millis() )
-    return lightSensorVal;
+  // Flash the number of any button pressed
+  for ( int b = 0; b < 4; b++ )
+  {
+    if ( state.clicks[b] != lastState.clicks[b] )
+      buttonStates[b] = 10;
+  }
 
-  // Set the next read time to 500ms from now
-  nextReadTimeLightSensor = millis() + 500;
+  // Clear out whatever was just switched off
+  if ( lastState.showLightSensor && !state.showLightSensor )
+    display.fillRect( 0, 15, 127, 14, BLACK);
+  if ( lastState.showIMU && !state.showIMU )
+    display.fillRect( 0, 30, 127, 30, BLACK);
 
+  if ( state.clicks[3] != lastState.clicks[3] )
+    currentState = 1;
+}
+
+// Scheduler jobs - these run on the I/O side
+
+void GrabLightSensor( void *context )
+{
   // Read the value from the sensor
-  lightSensorVal = analogRead( LIGHT_SENSOR );
-  return lightSensorVal;
+  ioState.lightSensorVal = adc.GetRaw( adcLight );
+  sharedState.Write( ioState );
+
+  telemetry.addLight( micros(), ioState.lightSensorVal );
 }
 
+void GrabBattery( void *context )
+{
+  telemetry.addBattery( micros(), tp.GetBatteryVoltage() * 1000 );
+}
 
-void GrabAccel()
+void ServiceTelemetry( void *context )
 {
-  // If it's not time to read the input, return early
-  if ( nextReadTimeIMU > millis() )
-    return;
+  // Telemetry is only touched from this side, so start it here once loop() has connected the WiFi
+  if ( !telemetryStarted && WiFi.status() == WL_CONNECTED )
+    telemetryStarted = telemetry.begin( secret_telemetry_host, secret_telemetry_port );
 
-  // Set the next read time to 200ms from now
-  nextReadTimeIMU = millis() + 200;
+  // Sends the batch once its oldest reading is a second old
+  telemetry.poll();
+}
+
+
+void ServiceAccel( void *context )
+{
+  // Cheap status read, only bursts the FIFO out once it has hit the watermark
+  accel.Service();
+}
 
-  sensors_event_t event;
-  lis.getEvent(&event);
+// Called by the accelerometer service with each block of FIFO samples
+void GrabAccel( void *context, const AccelSample *samples, uint8_t count, uint32_t newestTimeUs, uint32_t periodUs )
+{
+  // Every sample goes through the fixed point orientation filter, which smooths out the noise
+  orientation.Update( samples, count );
 
-  double x_Buff = float(event.acceleration.x);
-  double y_Buff = float(event.acceleration.y);
-  double z_Buff = float(event.acceleration.z);
+  // centidegrees to degrees
+  ioState.roll = orientation.GetRoll() / 100.0;
+  ioState.pitch = orientation.GetPitch() / 100.0;
+  sharedState.Write( ioState );
 
-  roll = atan2(y_Buff , z_Buff) * 57.3;
-  pitch = atan2((- x_Buff) , sqrt(y_Buff * y_Buff + z_Buff * z_Buff)) * 57.3;
+  for ( int i = 0; i < count; i++ )
+    telemetry.addAccel( newestTimeUs - ( count - 1 - i ) * periodUs, samples[ i ].x, samples[ i ].y, samples[ i ].z );
 }
 
 // Wifi Stuff
@@ -1,2 +1,6 @@
 const char* secret_ssid     = "enter_ssid_here";
 const char* secret_password = "enter_password_here";
+
+// Where telemetry is sent once WiFi is up - run tools/telemetry_rx on this machine
+const char* secret_telemetry_host = "192.168.1.100";
+const uint16_t secret_telemetry_port = 5005;
@@ -0,0 +1,161 @@
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include "telemetryformat.h"
+
+#define TELEMETRY_MAX_DATAGRAM 1400 // stays inside one Ethernet frame, so it never gets fragmented
+
+/*
+   Batched UDP telemetry
+   Samples are delta encoded into a datagram buffer (see telemetryformat.h) and sent when the next one
+   wouldn't fit, or when the oldest sample has waited maxAgeMs - one packet per second of IMU data at
+   100Hz instead of a hundred. While WiFi is down nothing is sent, and the lost samples are counted in
+   the next datagram that makes it out.
+
+   Call add...() and poll() from the same task - the I/O task on core 0 here, never loop().
+*/
+class Telemetry
+{
+  public:
+    bool begin(const char *host, uint16_t port, uint16_t maxBytes = TELEMETRY_MAX_DATAGRAM, uint32_t maxAgeMs = 1000);
+
+    void add(uint8_t stream, uint32_t timeUs, const int32_t *values, uint8_t count);
+    void addAccel(uint32_t timeUs, int16_t x, int16_t y, int16_t z)
+    {
+      int32_t v[3] = { x, y, z };
+      add(TELEM_ACCEL, timeUs, v, 3);
+    }
+    void addLight(uint32_t timeUs, uint16_t raw)
+    {
+      int32_t v = raw;
+      add(TELEM_LIGHT, timeUs, &v, 1);
+    }
+    void addBattery(uint32_t timeUs, uint16_t mv)
+    {
+      int32_t v = mv;
+      add(TELEM_BATTERY, timeUs, &v, 1);
+    }
+
+    // sends the batch if its oldest sample is too old - call often
+    void poll();
+    void flush();
+
+    uint32_t getPackets() { return _packets; }
+    uint32_t getBytes() { return _bytes; }
+    uint32_t getSamples() { return _samples; }
+    uint32_t getDropped() { return _droppedTotal; }
+
+  private:
+    void reset();
+
+    WiFiUDP _udp;
+    const char *_host = nullptr;
+    uint16_t _port = 0;
+    uint16_t _maxBytes = TELEMETRY_MAX_DATAGRAM;
+    uint32_t _maxAgeMs = 1000;
+    uint32_t _device = 0;
+
+    uint8_t _buf[TELEMETRY_MAX_DATAGRAM];
+    uint8_t *_pos = _buf + sizeof(TelemetryHeader);
+    uint16_t _count = 0;
+    uint32_t _firstMs = 0;
+    uint32_t _lastUs = 0;
+    int32_t _prev[TELEMETRY_MAX_STREAMS][TELEMETRY_MAX_VALUES];
+
+    uint32_t _seq = 0;
+    uint32_t _dropped = 0;
+    uint32_t _droppedTotal = 0;
+    uint32_t _packets = 0;
+    uint32_t _bytes = 0;
+    uint32_t _samples = 0;
+};
+
+bool Telemetry::begin(const char *host, uint16_t port, uint16_t maxBytes, uint32_t maxAgeMs)
+{
+  _host = host;
+  _port = port;
+  _maxBytes = constrain(maxBytes, sizeof(TelemetryHeader) + TELEMETRY_MAX_SAMPLE_BYTES, TELEMETRY_MAX_DATAGRAM);
+  _maxAgeMs = maxAgeMs;
+
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  _device = ((uint32_t)mac[2] << 24) | ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | mac[5];
+
+  reset();
+  return _udp.begin(0);
+}
+
+void Telemetry::reset()
+{
+  _pos = _buf + sizeof(TelemetryHeader);
+  _count = 0;
+  memset(_prev, 0, sizeof(_prev));
+}
+
+void Telemetry::add(uint8_t stream, uint32_t timeUs, const int32_t *values, uint8_t count)
+{
+  if (!_host || stream >= TELEMETRY_MAX_STREAMS)
+    return;
+  count = min(count, (uint8_t)TELEMETRY_MAX_VALUES);
+
+  // room for the worst case, so a sample never has to be split or backed out
+  if (_pos + TELEMETRY_MAX_SAMPLE_BYTES > _buf + _maxBytes)
+    flush();
+
+  if (_count == 0)
+  {
+    _firstMs = millis();
+    _lastUs = timeUs;
+    ((TelemetryHeader *)_buf)->baseUs = timeUs;
+  }
+
+  *_pos++ = stream | (count << 4);
+  _pos = telemetryPutVarint(_pos, (int32_t)(timeUs - _lastUs));
+  _lastUs = timeUs;
+
+  for (int i = 0; i < count; i++)
+  {
+    _pos = telemetryPutVarint(_pos, values[i] - _prev[stream][i]);
+    _prev[stream][i] = values[i];
+  }
+  _count++;
+}
+
+void Telemetry::poll()
+{
+  if (_count > 0 && millis() - _firstMs >= _maxAgeMs)
+    flush();
+}
+
+void Telemetry::flush()
+{
+  if (_count == 0)
+    return;
+
+  TelemetryHeader *h = (TelemetryHeader *)_buf;
+  h->magic = TELEMETRY_MAGIC;
+  h->version = TELEMETRY_VERSION;
+  h->reserved = 0;
+  h->device = _device;
+  h->seq = _seq;
+  h->samples = _count;
+  h->dropped = min(_dropped, (uint32_t)0xFFFF);
+
+  size_t len = _pos - _buf;
+  bool sent = WiFi.status() == WL_CONNECTED && _udp.beginPacket(_host, _port) && _udp.write(_buf, len) == len && _udp.endPacket();
+
+  if (sent)
+  {
+    _seq++;
+    _packets++;
+    _bytes += len;
+    _samples += _count;
+    _dropped = 0;
+  }
+  else
+  {
+    _dropped += _count;
+    _droppedTotal += _count;
+  }
+
+  reset();
+}
@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+   Telemetry datagram format
+   Shared by the sender (telemetry.h) and the receiver (../tools/telemetry_rx.cpp), so only plain C++ in here.
+
+   Each UDP datagram is a TelemetryHeader followed by a run of samples. A sample is:
+     1 byte        stream id in the low 4 bits, number of values in the high 4 bits
+     varint        time in us since the previous sample in the datagram (the header's baseUs for the first)
+     varint x n    each value as the difference from the same value in the previous sample of that stream
+
+   Varints are zigzag encoded, 7 bits a byte, low bits first, so small changes either way take one byte.
+   Every datagram starts its deltas from zero, so one that goes missing doesn't affect the next.
+*/
+
+#define TELEMETRY_MAGIC 0x5054 // "TP"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_MAX_VALUES 4
+#define TELEMETRY_MAX_STREAMS 16
+// stream byte, time and the values, at the most 5 bytes per varint
+#define TELEMETRY_MAX_SAMPLE_BYTES (1 + 5 + TELEMETRY_MAX_VALUES * 5)
+
+typedef enum
+{
+  TELEM_ACCEL = 0,    // x, y, z in LIS3DH counts
+  TELEM_LIGHT,        // raw ADC reading
+  TELEM_BATTERY,      // mV
+  TELEM_EXPANDER,     // MCP23017 ports, then up to 3 ADS1015 channels
+} TelemetryStream;
+
+struct __attribute__((packed)) TelemetryHeader
+{
+  uint16_t magic;
+  uint8_t version;
+  uint8_t reserved;
+  uint32_t device;    // low 32 bits of the sender's MAC address
+  uint32_t seq;       // datagram count, so the receiver can spot losses
+  uint32_t baseUs;    // micros() of the first sample
+  uint16_t samples;
+  uint16_t dropped;   // samples the sender couldn't send since the last datagram
+};
+
+static inline uint8_t *telemetryPutVarint(uint8_t *p, int32_t value)
+{
+  uint32_t z = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+  while (z >= 0x80)
+  {
+    *p++ = (uint8_t)(z | 0x80);
+    z >>= 7;
+  }
+  *p++ = (uint8_t)z;
+  return p;
+}
+
+// returns NULL if the varint runs past end
+static inline const uint8_t *telemetryGetVarint(const uint8_t *p, const uint8_t *end, int32_t *value)
+{
+  uint32_t z = 0;
+  for (int shift = 0; shift < 35; shift += 7)
+  {
+    if (p >= end)
+      return NULL;
+    uint8_t b = *p++;
+    z |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80))
+    {
+      *value = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+      return p;
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,150 @@
+/*
+   Receives and decodes Play shield telemetry datagrams, printing the samples as CSV
+
+   Build:   g++ -O2 -o telemetry_rx telemetry_rx.cpp
+   Usage:   telemetry_rx [port] [packets]
+
+   Listens on port (default 5005) and prints one row per sample:
+     device,seq,time_us,stream,v0,v1,v2,v3
+   Lost datagrams, and samples the sender reports it couldn't send, are noted on stderr.
+   With packets given it exits after that many datagrams, so it can stand in for the collector in tests.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "../TinyPICO-Play-Shield-Features/telemetryformat.h"
+
+static const char *streamNames[] = { "accel", "light", "battery", "expander" };
+
+struct Sender
+{
+  uint32_t device;
+  uint32_t nextSeq;
+};
+
+#define MAX_SENDERS 16
+
+static Sender senders[MAX_SENDERS];
+static int numSenders = 0;
+
+static Sender *findSender(uint32_t device)
+{
+  for (int i = 0; i < numSenders; i++)
+    if (senders[i].device == device)
+      return &senders[i];
+
+  if (numSenders == MAX_SENDERS)
+    return NULL;
+  senders[numSenders] = { device, 0 };
+  return &senders[numSenders++];
+}
+
+static bool decode(const uint8_t *buf, size_t len)
+{
+  TelemetryHeader h;
+  if (len < sizeof(h))
+    return false;
+  memcpy(&h, buf, sizeof(h));
+  if (h.magic != TELEMETRY_MAGIC || h.version != TELEMETRY_VERSION)
+    return false;
+
+  Sender *s = findSender(h.device);
+  if (s && s->nextSeq != 0 && h.seq != s->nextSeq)
+    fprintf(stderr, "%08x: %d datagrams lost\n", h.device, (int)(h.seq - s->nextSeq));
+  if (s)
+    s->nextSeq = h.seq + 1;
+  if (h.dropped)
+    fprintf(stderr, "%08x: %u samples dropped by the sender\n", h.device, h.dropped);
+
+  const uint8_t *p = buf + sizeof(h);
+  const uint8_t *end = buf + len;
+  int32_t prev[TELEMETRY_MAX_STREAMS][TELEMETRY_MAX_VALUES];
+  memset(prev, 0, sizeof(prev));
+  uint32_t time = h.baseUs;
+
+  for (int n = 0; n < h.samples; n++)
+  {
+    if (p >= end)
+      return false;
+    uint8_t stream = *p & 0x0F;
+    uint8_t count = *p >> 4;
+    p++;
+    if (count > TELEMETRY_MAX_VALUES)
+      return false;
+
+    int32_t dt;
+    if (!(p = telemetryGetVarint(p, end, &dt)))
+      return false;
+    time += dt;
+
+    printf("%08x,%u,%u,", h.device, h.seq, time);
+    if (stream < sizeof(streamNames) / sizeof(streamNames[0]))
+      printf("%s", streamNames[stream]);
+    else
+      printf("%u", stream);
+
+    for (int i = 0; i < count; i++)
+    {
+      int32_t delta;
+      if (!(p = telemetryGetVarint(p, end, &delta)))
+        return false;
+      prev[stream][i] += delta;
+      printf(",%d", prev[stream][i]);
+    }
+    printf("\n");
+  }
+
+  fflush(stdout);
+  return p == end;
+}
+
+int main(int argc, char **argv)
+{
+  int port = argc > 1 ? atoi(argv[1]) : 5005;
+  long packets = argc > 2 ? atol(argv[2]) : -1;
+
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0)
+  {
+    perror("socket");
+    return 1;
+  }
+
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(sock, (sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    perror("bind");
+    return 1;
+  }
+
+  fprintf(stderr, "listening on UDP port %d\n", port);
+  printf("device,seq,time_us,stream,v0,v1,v2,v3\n");
+  fflush(stdout);
+
+  uint8_t buf[2048];
+  while (packets != 0)
+  {
+    ssize_t len = recv(sock, buf, sizeof(buf), 0);
+    if (len < 0)
+    {
+      perror("recv");
+      break;
+    }
+    if (!decode(buf, len))
+      fprintf(stderr, "bad datagram (%d bytes)\n", (int)len);
+    if (packets > 0)
+      packets--;
+  }
+
+  close(sock);
+  return 0;
+}